@@ -30,6 +30,15 @@ def deps(repo_mapping = {}):
             strip_prefix = "glog-0.4.0",
         )
 
+    if "com_github_google_benchmark" not in native.existing_rules():
+        http_archive(
+            name = "com_github_google_benchmark",
+            url = "https://github.com/google/benchmark/archive/v1.6.1.tar.gz",
+            sha256 = "6132883bc8c9b0df5375b16ab520fac1a85dc9e4cf5be59480448ece74b278d4",
+            strip_prefix = "benchmark-1.6.1",
+            repo_mapping = repo_mapping,
+        )
+
     if "com_github_google_googletest" not in native.existing_rules():
         http_archive(
             name = "com_github_google_googletest",
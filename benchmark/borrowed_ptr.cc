@@ -0,0 +1,811 @@
+#include "stout/borrowed_ptr.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "stout/borrowable_map.h"
+#include "stout/borrowable_pool.h"
+#include "stout/scatter.h"
+#include "stout/thread_pool.h"
+
+using std::atomic;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+
+using stout::Borrowable;
+using stout::BorrowableMap;
+using stout::BorrowablePool;
+using stout::borrowed_exclusive_ptr;
+using stout::borrowed_ptr;
+using stout::borrowed_ref;
+
+////////////////////////////////////////////////////////////////////////
+
+// Runs a benchmark single threaded as well as with 2, 4, 8 and as
+// many threads as there are cores all contending on the same object.
+static void Threads(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ThreadRange(1, 8);
+
+  int cores = static_cast<int>(std::thread::hardware_concurrency());
+  if (cores > 8) {
+    benchmark->Threads(cores);
+  }
+
+  benchmark->UseRealTime();
+}
+
+////////////////////////////////////////////////////////////////////////
+
+struct Base {
+  int i = 42;
+};
+
+struct Derived : public Base {};
+
+////////////////////////////////////////////////////////////////////////
+
+// Baseline: copying and destroying a 'std::shared_ptr'.
+static void BM_SharedPtrCopy(benchmark::State& state) {
+  static shared_ptr<int> i = std::make_shared<int>(42);
+
+  for (auto _ : state) {
+    shared_ptr<int> copy = i;
+    benchmark::DoNotOptimize(copy);
+  }
+}
+
+BENCHMARK(BM_SharedPtrCopy)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Baseline: upcasting a copy of a 'std::shared_ptr'.
+static void BM_SharedPtrUpcast(benchmark::State& state) {
+  static shared_ptr<Derived> derived = std::make_shared<Derived>();
+
+  for (auto _ : state) {
+    shared_ptr<Base> base = derived;
+    benchmark::DoNotOptimize(base);
+  }
+}
+
+BENCHMARK(BM_SharedPtrUpcast)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+template <typename Policy>
+static void BM_Borrow(benchmark::State& state) {
+  static Borrowable<int, Policy> i(42);
+
+  for (auto _ : state) {
+    borrowed_ptr<int> borrowed = i.Borrow();
+    benchmark::DoNotOptimize(borrowed);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_Borrow, stout::Atomic)->Apply(Threads);
+BENCHMARK_TEMPLATE(BM_Borrow, stout::Sharded)->Apply(Threads);
+
+// NOTE: 'Biased' and 'SingleThreaded' borrowables must be destructed
+// on the thread that constructed them so they can't be shared between
+// benchmark threads like above, and since they are only borrowed on
+// the owning thread this measures their best case (and compares them
+// to 'Atomic' borrowed from a single thread).
+template <typename Policy>
+static void BM_BorrowOwner(benchmark::State& state) {
+  Borrowable<int, Policy> i(42);
+
+  for (auto _ : state) {
+    borrowed_ptr<int> borrowed = i.Borrow();
+    benchmark::DoNotOptimize(borrowed);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_BorrowOwner, stout::Atomic);
+BENCHMARK_TEMPLATE(BM_BorrowOwner, stout::Biased);
+BENCHMARK_TEMPLATE(BM_BorrowOwner, stout::SingleThreaded);
+
+template <typename Policy>
+static void BM_ReborrowOwner(benchmark::State& state) {
+  Borrowable<int, Policy> i(42);
+
+  borrowed_ptr<int> borrowed = i.Borrow();
+
+  for (auto _ : state) {
+    borrowed_ptr<int> reborrowed = borrowed.reborrow();
+    benchmark::DoNotOptimize(reborrowed);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_ReborrowOwner, stout::Atomic);
+BENCHMARK_TEMPLATE(BM_ReborrowOwner, stout::Biased);
+BENCHMARK_TEMPLATE(BM_ReborrowOwner, stout::SingleThreaded);
+
+////////////////////////////////////////////////////////////////////////
+
+template <typename Policy>
+static void BM_Reborrow(benchmark::State& state) {
+  static Borrowable<int, Policy> i(42);
+
+  borrowed_ptr<int> borrowed = i.Borrow();
+
+  for (auto _ : state) {
+    borrowed_ptr<int> reborrowed = borrowed.reborrow();
+    benchmark::DoNotOptimize(reborrowed);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_Reborrow, stout::Atomic)->Apply(Threads);
+BENCHMARK_TEMPLATE(BM_Reborrow, stout::Sharded)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Admission control with a limited borrowable (compare with
+// 'BM_Borrow<stout::Atomic>'), see 'LimitBorrows()'. The limit is
+// never reached so every borrow gets admitted.
+static void BM_TryBorrow(benchmark::State& state) {
+  static Borrowable<int>* i = []() {
+    auto* i = new Borrowable<int>(42);
+    i->LimitBorrows(std::numeric_limits<int>::max());
+    return i;
+  }();
+
+  for (auto _ : state) {
+    borrowed_ptr<int> borrowed = i->TryBorrow();
+    benchmark::DoNotOptimize(borrowed);
+  }
+}
+
+BENCHMARK(BM_TryBorrow)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Read borrows don't touch the tally, see 'borrowed_read_ref'.
+static void BM_Read(benchmark::State& state) {
+  static Borrowable<int> i(42);
+
+  for (auto _ : state) {
+    auto read = i.Read();
+    benchmark::DoNotOptimize(*read);
+  }
+}
+
+BENCHMARK(BM_Read)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+static void BM_BorrowedPtrUpcast(benchmark::State& state) {
+  static Borrowable<Derived> derived;
+
+  borrowed_ptr<Derived> borrowed = derived.Borrow();
+
+  for (auto _ : state) {
+    borrowed_ptr<Base> base = borrowed;
+    benchmark::DoNotOptimize(base);
+  }
+}
+
+BENCHMARK(BM_BorrowedPtrUpcast)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+static void BM_BorrowedCallableCopy(benchmark::State& state) {
+  static Borrowable<int> i(42);
+
+  auto callable = i.Borrow([]() {});
+
+  for (auto _ : state) {
+    auto copy = callable;
+    benchmark::DoNotOptimize(copy);
+  }
+}
+
+BENCHMARK(BM_BorrowedCallableCopy)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Borrows 'state.range(0)' times either with a single 'Borrow(n)' or
+// with individual calls to 'Borrow()'.
+static void BM_BorrowBatch(benchmark::State& state) {
+  static Borrowable<int> i(42);
+
+  size_t n = state.range(0);
+
+  for (auto _ : state) {
+    for (borrowed_ptr<int> borrowed : i.Borrow(n)) {
+      benchmark::DoNotOptimize(borrowed);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_BorrowBatch)->Arg(64)->Apply(Threads);
+
+static void BM_BorrowIndividually(benchmark::State& state) {
+  static Borrowable<int> i(42);
+
+  size_t n = state.range(0);
+
+  for (auto _ : state) {
+    for (size_t j = 0; j < n; j++) {
+      borrowed_ptr<int> borrowed = i.Borrow();
+      benchmark::DoNotOptimize(borrowed);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+BENCHMARK(BM_BorrowIndividually)->Arg(64)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Arms a watch and relinquishes the last borrow which invokes the
+// watch callback.
+template <typename Policy>
+static void BM_WatchFiring(benchmark::State& state) {
+  Borrowable<int, Policy> i(42);
+
+  size_t watched = 0;
+
+  for (auto _ : state) {
+    borrowed_ptr<int> borrowed = i.Borrow();
+    i.Watch([&]() { watched++; });
+    borrowed.relinquish();
+  }
+
+  benchmark::DoNotOptimize(watched);
+}
+
+BENCHMARK_TEMPLATE(BM_WatchFiring, stout::Atomic);
+BENCHMARK_TEMPLATE(BM_WatchFiring, stout::Sharded);
+BENCHMARK_TEMPLATE(BM_WatchFiring, stout::Biased);
+BENCHMARK_TEMPLATE(BM_WatchFiring, stout::SingleThreaded);
+
+// Simulates expensive cleanup in a watch callback.
+static void Cleanup(int64_t iterations) {
+  int64_t sum = 0;
+  for (int64_t i = 0; i < iterations; i++) {
+    benchmark::DoNotOptimize(sum += i);
+  }
+}
+
+// Measures how long relinquishing the last borrow takes when it
+// invokes an expensive watch callback inline versus when it only
+// submits the callback to an executor, see 'Watch(executor, f)'.
+template <bool kExecutor>
+static void BM_RelinquishWatched(benchmark::State& state) {
+  static stout::ThreadPool pool(1);
+
+  Borrowable<int> i(42);
+
+  atomic<size_t> watched(0);
+
+  size_t expected = 0;
+
+  for (auto _ : state) {
+    borrowed_ptr<int> borrowed = i.Borrow();
+
+    auto f = [&, iterations = state.range(0)]() {
+      Cleanup(iterations);
+      watched.fetch_add(1);
+    };
+
+    if constexpr (kExecutor) {
+      i.Watch(pool, std::move(f));
+    } else {
+      i.Watch(std::move(f));
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    borrowed.relinquish();
+
+    auto end = std::chrono::high_resolution_clock::now();
+
+    state.SetIterationTime(
+        std::chrono::duration<double>(end - start).count());
+
+    // Wait for the callback so we don't queue up unbounded work.
+    expected++;
+    while (watched.load() != expected) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_RelinquishWatched, false)
+    ->Arg(1000)
+    ->Arg(100000)
+    ->UseManualTime();
+BENCHMARK_TEMPLATE(BM_RelinquishWatched, true)
+    ->Arg(1000)
+    ->Arg(100000)
+    ->UseManualTime();
+
+////////////////////////////////////////////////////////////////////////
+
+// Measures how long it takes for '~Borrowable' to return when the
+// last borrow gets relinquished by another thread, i.e., the latency
+// of draining (including handing off the borrow).
+static void BM_BorrowableDrain(benchmark::State& state) {
+  atomic<borrowed_ptr<string>*> handoff(nullptr);
+  atomic<bool> done(false);
+
+  thread relinquisher([&]() {
+    while (!done.load()) {
+      borrowed_ptr<string>* borrowed = handoff.exchange(nullptr);
+      if (borrowed != nullptr) {
+        // Take ownership of the borrow before relinquishing it so
+        // that the main thread's (now empty) 'borrowed_ptr' isn't
+        // still being written once '~Borrowable' returns.
+        borrowed_ptr<string> owned = std::move(*borrowed);
+        owned.relinquish();
+      }
+    }
+  });
+
+  for (auto _ : state) {
+    auto s = std::make_unique<Borrowable<string>>("hello world");
+
+    borrowed_ptr<string> borrowed = s->Borrow();
+
+    handoff.store(&borrowed);
+
+    // Waits until 'relinquisher' has relinquished.
+    s.reset();
+  }
+
+  done.store(true);
+
+  relinquisher.join();
+}
+
+BENCHMARK(BM_BorrowableDrain)->UseRealTime();
+
+////////////////////////////////////////////////////////////////////////
+
+// Baseline: how long it takes for the last 'std::shared_ptr' to be
+// destroyed on another thread (i.e., the same handoff as above).
+static void BM_SharedPtrDrain(benchmark::State& state) {
+  atomic<shared_ptr<string>*> handoff(nullptr);
+  atomic<bool> done(false);
+  atomic<size_t> destroyed(0);
+
+  thread destroyer([&]() {
+    while (!done.load()) {
+      shared_ptr<string>* s = handoff.exchange(nullptr);
+      if (s != nullptr) {
+        s->reset();
+        destroyed.fetch_add(1);
+      }
+    }
+  });
+
+  size_t expected = 0;
+
+  for (auto _ : state) {
+    auto s = std::make_shared<string>("hello world");
+
+    handoff.store(&s);
+
+    expected++;
+
+    while (destroyed.load() != expected) {}
+  }
+
+  done.store(true);
+
+  destroyer.join();
+}
+
+BENCHMARK(BM_SharedPtrDrain)->UseRealTime();
+
+////////////////////////////////////////////////////////////////////////
+
+// Reads small borrowables laid out next to each other (e.g., in a
+// vector) while another thread keeps borrowing and relinquishing
+// them. Without 'CacheAligned' the tally of one borrowable can end up
+// on the same cache line as the 'T' of its neighbour which then keeps
+// getting invalidated (i.e., false sharing).
+template <typename Policy>
+static void BM_ReadWhileBorrowing(benchmark::State& state) {
+  constexpr size_t kBorrowables = 64;
+
+  auto borrowables =
+      std::make_unique<Borrowable<int64_t, Policy>[]>(kBorrowables);
+
+  atomic<bool> done(false);
+
+  thread borrower([&]() {
+    while (!done.load(std::memory_order_relaxed)) {
+      for (size_t i = 0; i < kBorrowables; i++) {
+        borrowed_ptr<int64_t> borrowed = borrowables[i].Borrow();
+        benchmark::DoNotOptimize(borrowed.get());
+      }
+    }
+  });
+
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < kBorrowables; i++) {
+      sum += *borrowables[i];
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+
+  done.store(true);
+
+  borrower.join();
+}
+
+BENCHMARK_TEMPLATE(BM_ReadWhileBorrowing, stout::Atomic)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReadWhileBorrowing, stout::CacheAligned<>)
+    ->UseRealTime();
+
+////////////////////////////////////////////////////////////////////////
+
+// Dereferences every borrow in a large vector, which for
+// 'borrowed_compact_ptr' takes up half as much memory.
+template <typename Borrowed>
+static void BM_IterateBorrows(benchmark::State& state) {
+  constexpr size_t kBorrows = 1 << 16;
+
+  Borrowable<int64_t> i(42);
+
+  std::vector<Borrowed> borrows;
+  borrows.reserve(kBorrows);
+  for (size_t j = 0; j < kBorrows; j++) {
+    if constexpr (std::is_same_v<Borrowed, borrowed_ptr<int64_t>>) {
+      borrows.push_back(i.Borrow());
+    } else {
+      borrows.push_back(i.BorrowCompact());
+    }
+  }
+
+  for (auto _ : state) {
+    int64_t sum = 0;
+    for (const auto& borrowed : borrows) {
+      sum += *borrowed;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+}
+
+BENCHMARK_TEMPLATE(BM_IterateBorrows, borrowed_ptr<int64_t>);
+BENCHMARK_TEMPLATE(BM_IterateBorrows, stout::borrowed_compact_ptr<int64_t>);
+
+////////////////////////////////////////////////////////////////////////
+
+// Splits a span into chunks (e.g., one per worker) which reborrows
+// all of the chunks with a single atomic operation.
+static void BM_SplitSpan(benchmark::State& state) {
+  Borrowable<std::vector<int>> v(std::vector<int>(1 << 16, 1));
+
+  stout::borrowed_span<int> span = v.BorrowSpan();
+
+  for (auto _ : state) {
+    auto chunks = span.split(state.range(0));
+    benchmark::DoNotOptimize(chunks.data());
+  }
+}
+
+BENCHMARK(BM_SplitSpan)->Arg(4)->Arg(64);
+
+// Sums a span, which should vectorize just like summing a vector.
+static void BM_SumSpan(benchmark::State& state) {
+  Borrowable<std::vector<int>> v(std::vector<int>(1 << 16, 1));
+
+  stout::borrowed_span<int> span = v.BorrowSpan();
+
+  for (auto _ : state) {
+    int sum = 0;
+    for (int i : span) {
+      sum += i;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+}
+
+BENCHMARK(BM_SumSpan);
+
+////////////////////////////////////////////////////////////////////////
+
+// Takes and gives back borrows from a per thread lease of the same
+// borrowable, which only touches the tally once per 'range(0)' borrows.
+static void BM_Lease(benchmark::State& state) {
+  static Borrowable<int> i(42);
+
+  auto lease = i.Lease(state.range(0));
+
+  for (auto _ : state) {
+    borrowed_ptr<int> borrowed = lease.take();
+    benchmark::DoNotOptimize(borrowed.get());
+    lease.give_back(std::move(borrowed));
+  }
+}
+
+BENCHMARK(BM_Lease)->Arg(64)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Fans out 'range(0)' tasks that each get a borrow and waits until
+// they've all relinquished using 'Scatter()'.
+static void BM_Scatter(benchmark::State& state) {
+  static stout::ThreadPool pool;
+
+  Borrowable<atomic<int64_t>> sum(0);
+
+  for (auto _ : state) {
+    atomic<bool> done(false);
+
+    stout::Scatter(
+        sum,
+        state.range(0),
+        [](size_t i, borrowed_ptr<atomic<int64_t>> sum) {
+          sum->fetch_add(i, std::memory_order_relaxed);
+        },
+        pool,
+        [&]() {
+          done.store(true);
+        });
+
+    while (!done.load()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+BENCHMARK(BM_Scatter)->Arg(16)->UseRealTime();
+
+// Baseline: the same fan out using 'Borrow()' and 'std::async()'
+// for each task.
+static void BM_BorrowAsync(benchmark::State& state) {
+  Borrowable<atomic<int64_t>> sum(0);
+
+  for (auto _ : state) {
+    std::vector<std::future<void>> futures;
+
+    for (int64_t i = 0; i < state.range(0); i++) {
+      futures.push_back(std::async(
+          std::launch::async,
+          [i, sum = borrowed_ptr<atomic<int64_t>>(sum.Borrow())]() {
+            sum->fetch_add(i, std::memory_order_relaxed);
+          }));
+    }
+
+    for (auto& future : futures) {
+      future.wait();
+    }
+  }
+}
+
+BENCHMARK(BM_BorrowAsync)->Arg(16)->UseRealTime();
+
+////////////////////////////////////////////////////////////////////////
+
+// Constructs, borrows and destructs short-lived borrowables using a
+// 'BorrowablePool' versus allocating each one.
+static void BM_MakePooled(benchmark::State& state) {
+  static BorrowablePool<string> pool;
+
+  for (auto _ : state) {
+    borrowed_ptr<string> borrowed = pool.Make("hello world");
+    benchmark::DoNotOptimize(borrowed.get());
+  }
+}
+
+BENCHMARK(BM_MakePooled)->Apply(Threads);
+
+static void BM_MakeAllocated(benchmark::State& state) {
+  for (auto _ : state) {
+    auto s = std::make_unique<Borrowable<string>>("hello world");
+    borrowed_ptr<string> borrowed = s->Borrow();
+    benchmark::DoNotOptimize(borrowed.get());
+  }
+}
+
+BENCHMARK(BM_MakeAllocated)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Borrowing through a 'borrowed_weak', e.g., for a cache lookup,
+// versus the baseline of locking a 'std::weak_ptr'.
+static void BM_TryBorrowWeak(benchmark::State& state) {
+  static Borrowable<int> i(42);
+  static stout::borrowed_weak<int> weak = i.Weak();
+
+  for (auto _ : state) {
+    borrowed_ptr<int> borrowed = weak.try_borrow();
+    benchmark::DoNotOptimize(borrowed.get());
+  }
+}
+
+BENCHMARK(BM_TryBorrowWeak)->Apply(Threads);
+
+static void BM_LockWeakPtr(benchmark::State& state) {
+  static shared_ptr<int> i = std::make_shared<int>(42);
+  static std::weak_ptr<int> weak = i;
+
+  for (auto _ : state) {
+    shared_ptr<int> locked = weak.lock();
+    benchmark::DoNotOptimize(locked.get());
+  }
+}
+
+BENCHMARK(BM_LockWeakPtr)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Looking up (and borrowing) values in a 'BorrowableMap' versus the
+// baseline of a 'std::unordered_map' of 'std::shared_ptr' protected
+// by a mutex, both with 'kMapKeys' keys.
+static constexpr int kMapKeys = 1024;
+
+static void BM_BorrowableMapLookup(benchmark::State& state) {
+  static BorrowableMap<int, int64_t>* map = []() {
+    auto* map = new BorrowableMap<int, int64_t>(kMapKeys);
+    for (int key = 0; key < kMapKeys; key++) {
+      map->Insert(key, key);
+    }
+    return map;
+  }();
+
+  int key = state.thread_index();
+
+  for (auto _ : state) {
+    borrowed_ptr<int64_t> value = map->Lookup(key++ % kMapKeys);
+    benchmark::DoNotOptimize(*value);
+  }
+}
+
+BENCHMARK(BM_BorrowableMapLookup)->Apply(Threads);
+
+static void BM_SharedPtrMapLookup(benchmark::State& state) {
+  static std::mutex mutex;
+  static std::unordered_map<int, shared_ptr<int64_t>>* map = []() {
+    auto* map = new std::unordered_map<int, shared_ptr<int64_t>>();
+    for (int key = 0; key < kMapKeys; key++) {
+      map->emplace(key, std::make_shared<int64_t>(key));
+    }
+    return map;
+  }();
+
+  int key = state.thread_index();
+
+  for (auto _ : state) {
+    shared_ptr<int64_t> value;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      value = map->at(key++ % kMapKeys);
+    }
+    benchmark::DoNotOptimize(*value);
+  }
+}
+
+BENCHMARK(BM_SharedPtrMapLookup)->Apply(Threads);
+
+// Erasing (and inserting again) a value that is borrowed elsewhere.
+static void BM_BorrowableMapEraseWhileBorrowed(benchmark::State& state) {
+  BorrowableMap<int, int64_t> map(kMapKeys);
+
+  map.Insert(0, 0);
+
+  for (auto _ : state) {
+    borrowed_ptr<int64_t> value = map.Lookup(0);
+    map.Erase(0);
+    map.Insert(0, 0);
+    benchmark::DoNotOptimize(*value);
+  }
+}
+
+BENCHMARK(BM_BorrowableMapEraseWhileBorrowed);
+
+static void BM_SharedPtrMapEraseWhileBorrowed(benchmark::State& state) {
+  std::mutex mutex;
+  std::unordered_map<int, shared_ptr<int64_t>> map;
+
+  map.emplace(0, std::make_shared<int64_t>(0));
+
+  for (auto _ : state) {
+    shared_ptr<int64_t> value;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      value = map.at(0);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      map.erase(0);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      map.emplace(0, std::make_shared<int64_t>(0));
+    }
+    benchmark::DoNotOptimize(*value);
+  }
+}
+
+BENCHMARK(BM_SharedPtrMapEraseWhileBorrowed);
+
+////////////////////////////////////////////////////////////////////////
+
+// Borrowing (and relinquishing) the same borrowable 'range(0)' times
+// per batch while deferring relinquishes, see 'BM_Borrow' for the
+// baseline.
+static void BM_BorrowDeferred(benchmark::State& state) {
+  static Borrowable<int> i(42);
+
+  for (auto _ : state) {
+    stout::DeferRelinquish defer;
+    for (int64_t n = 0; n < state.range(0); n++) {
+      borrowed_ptr<int> borrowed = i.Borrow();
+      benchmark::DoNotOptimize(borrowed);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_BorrowDeferred)->Arg(64)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
+
+// Read-mostly contention where one in 'range(0)' borrows writes (or
+// never writes if 0), using shared and exclusive borrows versus the
+// baseline of borrowing and then locking a 'std::shared_mutex'.
+static void BM_BorrowSharedExclusive(benchmark::State& state) {
+  static Borrowable<int64_t> i(0);
+
+  int64_t n = 0;
+
+  for (auto _ : state) {
+    if (state.range(0) != 0 && ++n % state.range(0) == 0) {
+      borrowed_exclusive_ptr<int64_t> exclusive = i.BorrowExclusive();
+      ++*exclusive;
+    } else {
+      borrowed_ref<const int64_t> shared = i.BorrowShared();
+      benchmark::DoNotOptimize(*shared);
+    }
+  }
+}
+
+BENCHMARK(BM_BorrowSharedExclusive)->Arg(0)->Arg(16)->Apply(Threads);
+
+static void BM_BorrowSharedMutex(benchmark::State& state) {
+  struct Locked {
+    std::shared_mutex mutex;
+    int64_t i = 0;
+  };
+
+  static Borrowable<Locked> locked;
+
+  int64_t n = 0;
+
+  for (auto _ : state) {
+    borrowed_ref<Locked> borrowed = locked.Borrow();
+    if (state.range(0) != 0 && ++n % state.range(0) == 0) {
+      std::unique_lock<std::shared_mutex> lock(borrowed->mutex);
+      ++borrowed->i;
+    } else {
+      std::shared_lock<std::shared_mutex> lock(borrowed->mutex);
+      benchmark::DoNotOptimize(borrowed->i);
+    }
+  }
+}
+
+BENCHMARK(BM_BorrowSharedMutex)->Arg(0)->Arg(16)->Apply(Threads);
+
+////////////////////////////////////////////////////////////////////////
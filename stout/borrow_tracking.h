@@ -0,0 +1,391 @@
+#pragma once
+
+// Tracking of outstanding borrows is only done when compiled with
+// 'STOUT_BORROWABLE_TRACKING' defined, otherwise everything in this
+// file except 'SourceLocation' is empty and has no cost.
+//
+// Tracking is meant to be cheap enough to leave enabled in canary
+// builds: only every 'STOUT_BORROWABLE_TRACKING_SAMPLE' borrow on each
+// thread gets tracked (by default every borrow) and only every
+// 'STOUT_BORROWABLE_TRACKING_STACKS' tracked borrow captures a stack
+// trace (by default none do).
+
+#ifdef STOUT_BORROWABLE_TRACKING
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ostream>
+#include <string>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define STOUT_BORROWABLE_TRACKING_HAS_BACKTRACE
+#endif
+
+#ifndef STOUT_BORROWABLE_TRACKING_SAMPLE
+#define STOUT_BORROWABLE_TRACKING_SAMPLE 1
+#endif
+
+#ifndef STOUT_BORROWABLE_TRACKING_STACKS
+#define STOUT_BORROWABLE_TRACKING_STACKS 0
+#endif
+
+#ifndef STOUT_BORROWABLE_TRACKING_DEADLINE_MS
+#define STOUT_BORROWABLE_TRACKING_DEADLINE_MS 1000
+#endif
+#endif // STOUT_BORROWABLE_TRACKING
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// Where something happened in the source, e.g., where a borrow was
+// made. Use as a default argument to capture the location of the
+// caller, i.e., 'SourceLocation location = SourceLocation::current()',
+// like 'std::source_location' in C++20.
+struct SourceLocation final {
+  static constexpr SourceLocation current(
+      const char* file = __builtin_FILE(),
+      int line = __builtin_LINE(),
+      const char* function = __builtin_FUNCTION()) {
+    return SourceLocation{file, line, function};
+  }
+
+  const char* file = nullptr;
+  int line = 0;
+  const char* function = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+#ifdef STOUT_BORROWABLE_TRACKING
+
+// Keeps a record of where (and optionally from which stack) each
+// sampled borrow was made for as long as it's outstanding so that a
+// borrowable that is stuck waiting for its borrows to be relinquished
+// (e.g., when destructing) can report who is still borrowing it.
+//
+// Each thread gets a 'Tracker' which is registered in a global
+// lock-free list the first time the thread tracks a borrow (and
+// reused by another thread after its thread exits, just like the
+// readers of a 'GracePeriod'). A tracker only ever adds records to
+// its own list and reuses records after they've been released (which
+// may happen on any thread) so tracking a borrow never takes a lock.
+//
+// Records are never deallocated so that dumping can safely iterate
+// through them while they're being reused, instead each record has a
+// version which is odd while it's being rewritten so that dumping can
+// skip any record that changed while it was being read.
+class BorrowTracking final {
+ public:
+  static constexpr size_t kSampleEvery = STOUT_BORROWABLE_TRACKING_SAMPLE;
+  static constexpr size_t kStacksEvery = STOUT_BORROWABLE_TRACKING_STACKS;
+  static constexpr size_t kMaxStackDepth = 16;
+
+  static_assert(kSampleEvery > 0, "Must sample at least some borrows");
+
+  struct Tracker;
+
+  struct Record {
+    SourceLocation location() const {
+      return SourceLocation{
+          file.load(std::memory_order_relaxed),
+          line.load(std::memory_order_relaxed),
+          function.load(std::memory_order_relaxed)};
+    }
+
+    std::atomic<uint64_t> version = 0;
+
+    // 'nullptr' unless the record is of an outstanding borrow.
+    std::atomic<const void*> borrowable = nullptr;
+
+    std::atomic<const char*> file = nullptr;
+    std::atomic<int> line = 0;
+    std::atomic<const char*> function = nullptr;
+    std::atomic<std::chrono::steady_clock::rep> borrowed = 0;
+    std::atomic<int> depth = 0;
+    std::array<std::atomic<void*>, kMaxStackDepth> stack = {};
+
+    Tracker* const tracker;
+    Record* next = nullptr;
+
+    // Next record in either the tracker's 'released' or 'free' list.
+    Record* next_free = nullptr;
+
+    explicit Record(Tracker* tracker)
+      : tracker(tracker) {}
+  };
+
+  // Returns a record of a borrow of 'borrowable' at 'location' or
+  // 'nullptr' if the borrow wasn't sampled.
+  static Record* Track(
+      const void* borrowable,
+      const SourceLocation& location) {
+    Tracker& tracker = Local();
+
+    if (++tracker.borrows % kSampleEvery != 0) {
+      return nullptr;
+    }
+
+    void* stack[kMaxStackDepth];
+    int depth = 0;
+#ifdef STOUT_BORROWABLE_TRACKING_HAS_BACKTRACE
+    if (kStacksEvery > 0 && ++tracker.tracked % kStacksEvery == 0) {
+      depth = backtrace(stack, kMaxStackDepth);
+    }
+#endif
+
+    Record* record = tracker.Allocate();
+
+    uint64_t version = record->version.load(std::memory_order_relaxed);
+    record->version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    record->file.store(location.file, std::memory_order_relaxed);
+    record->line.store(location.line, std::memory_order_relaxed);
+    record->function.store(location.function, std::memory_order_relaxed);
+    record->borrowed.store(
+        std::chrono::steady_clock::now().time_since_epoch().count(),
+        std::memory_order_relaxed);
+    record->depth.store(depth, std::memory_order_relaxed);
+    for (int i = 0; i < depth; i++) {
+      record->stack[i].store(stack[i], std::memory_order_relaxed);
+    }
+    record->borrowable.store(borrowable, std::memory_order_relaxed);
+
+    record->version.store(version + 2, std::memory_order_release);
+
+    return record;
+  }
+
+  // Releases a record returned from 'Track()' once its borrow has
+  // been relinquished, possibly on a different thread.
+  static void Untrack(Record* record) {
+    if (record != nullptr) {
+      record->borrowable.store(nullptr, std::memory_order_relaxed);
+      record->tracker->Release(record);
+    }
+  }
+
+  // Dumps every outstanding (sampled) borrow of 'borrowable', one
+  // per line (with one more line per stack frame, if any), and
+  // returns how many there were.
+  static size_t Dump(const void* borrowable, std::ostream& os) {
+    size_t outstanding = 0;
+
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+
+    for (Tracker* tracker = trackers().load();
+         tracker != nullptr;
+         tracker = tracker->next) {
+      for (Record* record = tracker->records.load();
+           record != nullptr;
+           record = record->next) {
+        uint64_t version = record->version.load(std::memory_order_acquire);
+        if (version % 2 == 1
+            || record->borrowable.load(std::memory_order_relaxed)
+                != borrowable) {
+          continue;
+        }
+
+        SourceLocation location = record->location();
+        auto borrowed = std::chrono::steady_clock::duration(
+            record->borrowed.load(std::memory_order_relaxed));
+        int depth = record->depth.load(std::memory_order_relaxed);
+        void* stack[kMaxStackDepth];
+        for (int i = 0; i < depth; i++) {
+          stack[i] = record->stack[i].load(std::memory_order_relaxed);
+        }
+
+        // Skip the record if it was rewritten while we read it.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (record->version.load(std::memory_order_relaxed) != version) {
+          continue;
+        }
+
+        outstanding++;
+
+        os << "borrowed at "
+           << (location.file != nullptr ? location.file : "?")
+           << ":" << location.line
+           << " in "
+           << (location.function != nullptr ? location.function : "?")
+           << " " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         now - borrowed)
+                         .count()
+           << "ms ago\n";
+
+        PrintStack(stack, depth, os);
+      }
+    }
+
+    return outstanding;
+  }
+
+  // How long to wait for borrows to be relinquished before dumping
+  // the outstanding borrows, by default
+  // 'STOUT_BORROWABLE_TRACKING_DEADLINE_MS'.
+  static std::chrono::milliseconds deadline() {
+    return std::chrono::milliseconds(
+        deadline_ms().load(std::memory_order_relaxed));
+  }
+
+  static void deadline(std::chrono::milliseconds deadline) {
+    deadline_ms().store(deadline.count(), std::memory_order_relaxed);
+  }
+
+  // Gets invoked with the report of a borrowable whose destructor (or
+  // anything else waiting for its borrows) has been waiting longer
+  // than the deadline, by default (i.e., when nullptr) the report
+  // gets logged as a warning.
+  using Reporter = void (*)(const void* borrowable, const std::string&);
+
+  static Reporter reporter() {
+    return reporter_().load(std::memory_order_relaxed);
+  }
+
+  static void reporter(Reporter reporter) {
+    reporter_().store(reporter, std::memory_order_relaxed);
+  }
+
+  struct alignas(64) Tracker {
+    // Returns a record that isn't being used by any borrow, reusing a
+    // released record when possible.
+    Record* Allocate() {
+      if (free == nullptr) {
+        free = released.exchange(nullptr, std::memory_order_acquire);
+      }
+
+      if (free != nullptr) {
+        Record* record = free;
+        free = record->next_free;
+        return record;
+      }
+
+      // NOTE: only this tracker adds records to its list but others
+      // might be iterating through it while dumping.
+      Record* record = new Record(this);
+      record->next = records.load(std::memory_order_relaxed);
+      records.store(record, std::memory_order_release);
+      return record;
+    }
+
+    void Release(Record* record) {
+      record->next_free = released.load(std::memory_order_relaxed);
+      while (!released.compare_exchange_weak(
+          record->next_free,
+          record,
+          std::memory_order_release,
+          std::memory_order_relaxed)) {}
+    }
+
+    std::atomic<Record*> records = nullptr;
+
+    // Records released by any thread, taken all at once by the
+    // registered thread when it runs out of 'free' records.
+    std::atomic<Record*> released = nullptr;
+
+    std::atomic<bool> registered = true;
+    Tracker* next = nullptr;
+
+    // Only ever accessed by the thread that has registered.
+    Record* free = nullptr;
+    size_t borrows = 0;
+    size_t tracked = 0;
+  };
+
+ private:
+  static void PrintStack(
+      void* const* stack,
+      int depth,
+      std::ostream& os) {
+#ifdef STOUT_BORROWABLE_TRACKING_HAS_BACKTRACE
+    if (depth > 0) {
+      char** symbols = backtrace_symbols(stack, depth);
+      for (int i = 0; i < depth; i++) {
+        os << "    #" << i << " ";
+        if (symbols != nullptr) {
+          os << symbols[i];
+        } else {
+          os << stack[i];
+        }
+        os << "\n";
+      }
+      std::free(symbols);
+    }
+#endif
+  }
+
+  struct Registration {
+    ~Registration() {
+      if (tracker != nullptr) {
+        tracker->registered.store(false);
+      }
+    }
+
+    Tracker* tracker = nullptr;
+  };
+
+  static std::atomic<int64_t>& deadline_ms() {
+    static std::atomic<int64_t> deadline(
+        STOUT_BORROWABLE_TRACKING_DEADLINE_MS);
+    return deadline;
+  }
+
+  static std::atomic<Reporter>& reporter_() {
+    static std::atomic<Reporter> reporter(nullptr);
+    return reporter;
+  }
+
+  static std::atomic<Tracker*>& trackers() {
+    static std::atomic<Tracker*> trackers(nullptr);
+    return trackers;
+  }
+
+  static Registration& LocalRegistration() {
+    static thread_local Registration registration;
+    return registration;
+  }
+
+  static Tracker& Local() {
+    auto& registration = LocalRegistration();
+
+    if (registration.tracker == nullptr) {
+      // Try and reuse a tracker from a thread that has exited.
+      for (Tracker* tracker = trackers().load();
+           tracker != nullptr;
+           tracker = tracker->next) {
+        bool registered = false;
+        if (!tracker->registered.load()
+            && tracker->registered.compare_exchange_strong(
+                registered,
+                true)) {
+          registration.tracker = tracker;
+          return *tracker;
+        }
+      }
+
+      // NOTE: trackers are never deallocated since a thread dumping
+      // might be iterating through them.
+      Tracker* tracker = new Tracker();
+      tracker->next = trackers().load();
+      while (!trackers().compare_exchange_weak(tracker->next, tracker)) {}
+
+      registration.tracker = tracker;
+    }
+
+    return *registration.tracker;
+  }
+};
+
+#endif // STOUT_BORROWABLE_TRACKING
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
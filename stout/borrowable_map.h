@@ -0,0 +1,250 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "glog/logging.h"
+#include "stout/borrowed_ptr.h"
+#include "stout/grace_period.h"
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// A concurrent hash map of borrowable values, e.g., sessions, where
+// 'Lookup()' returns a borrow of a value without taking any locks and
+// 'Erase()' never waits for borrows of the value to be relinquished.
+//
+// Each bucket is a singly linked list of nodes (each of which is a
+// 'Borrowable<V>' along with its key) that 'Insert()' and 'Erase()'
+// modify while holding the lock of the bucket's stripe and that
+// 'Lookup()' traverses from within a read-side critical section, see
+// 'GracePeriodDomain'. Erasing unlinks the node right away, waits for
+// a grace period (i.e., for any lookups that might still be
+// traversing the node, never for borrows) and then orphans the node
+// so that it gets destructed (and deallocated) by whichever thread
+// relinquishes the last borrow of the value, just like a
+// 'borrowable_owner'.
+//
+// Lookups use their own grace period domain (shared by all maps with
+// the same types) so erasing only ever waits for lookups, which never
+// block, and not for any 'borrowed_read_ref' (which can be held for
+// arbitrarily long). It's fine to erase while holding a
+// 'borrowed_read_ref'.
+//
+// NOTE: the number of buckets is fixed when constructing so it should
+// be chosen for the expected number of values.
+template <
+    typename K,
+    typename V,
+    typename Hash = std::hash<K>,
+    typename Equal = std::equal_to<K>>
+class BorrowableMap final {
+ public:
+  // Number of locks shared by the buckets.
+  static constexpr size_t kStripes = 64;
+
+  explicit BorrowableMap(size_t buckets = 1024)
+    : buckets_(new std::atomic<Node*>[Round(buckets)]),
+      mask_(Round(buckets) - 1) {
+    for (size_t i = 0; i <= mask_; i++) {
+      buckets_[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  BorrowableMap(const BorrowableMap&) = delete;
+  BorrowableMap(BorrowableMap&&) = delete;
+
+  // Orphans all of the values without waiting for any outstanding
+  // borrows, see 'Erase()'.
+  ~BorrowableMap() {
+    Lookups::Wait();
+
+    for (size_t i = 0; i <= mask_; i++) {
+      Node* node = buckets_[i].load();
+      while (node != nullptr) {
+        // NOTE: 'Orphan()' might destruct (and deallocate) the node
+        // before it returns.
+        std::exchange(node, node->next.load())->Orphan();
+      }
+    }
+  }
+
+  BorrowableMap& operator=(const BorrowableMap&) = delete;
+  BorrowableMap& operator=(BorrowableMap&&) = delete;
+
+  // Returns the number of values, which might be stale if there are
+  // concurrent inserts or erases.
+  size_t size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+  // Constructs a value from 'args' for 'key' unless there already is
+  // a value for 'key' in which case returns false.
+  template <typename... Args>
+  bool Insert(const K& key, Args&&... args) {
+    size_t hash = hash_(key);
+
+    std::lock_guard<std::mutex> lock(StripeFor(hash).mutex);
+
+    std::atomic<Node*>& bucket = BucketFor(hash);
+
+    if (Find(bucket, hash, key) != nullptr) {
+      return false;
+    }
+
+    auto* node = new Node(key, hash, std::forward<Args>(args)...);
+
+    node->next.store(bucket.load(std::memory_order_relaxed));
+
+    // NOTE: release so that a concurrent 'Lookup()' that sees the
+    // node also sees it fully constructed.
+    bucket.store(node, std::memory_order_release);
+
+    size_.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+  }
+
+  // Borrows the value for 'key' without taking any locks, returns an
+  // empty 'borrowed_ptr' if there isn't a value for 'key' (or it
+  // can't be borrowed, see 'TryBorrow()').
+  borrowed_ptr<V> Lookup(
+      const K& key,
+      const SourceLocation& location = SourceLocation::current()) {
+    size_t hash = hash_(key);
+
+    borrowed_ptr<V> borrowed;
+
+    Lookups::Enter();
+
+    Node* node = Find(BucketFor(hash), hash, key);
+
+    if (node != nullptr) {
+      // NOTE: fails if the node has already been orphaned, i.e.,
+      // erased, even if we found it before it got unlinked.
+      borrowed = node->TryBorrow(location);
+    }
+
+    Lookups::Exit();
+
+    return borrowed;
+  }
+
+  // Unlinks the value for 'key' so that it can no longer be looked
+  // up, which then gets destructed once all of its outstanding
+  // borrows have been relinquished (or right away if there aren't
+  // any). Returns false if there isn't a value for 'key'.
+  bool Erase(const K& key) {
+    size_t hash = hash_(key);
+
+    Node* node = nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(StripeFor(hash).mutex);
+
+      std::atomic<Node*>* link = &BucketFor(hash);
+
+      while ((node = link->load(std::memory_order_relaxed)) != nullptr) {
+        if (node->hash == hash && equal_(node->key, key)) {
+          // NOTE: the node still points at the rest of the bucket so
+          // that any lookups still traversing it can keep going.
+          link->store(node->next.load(std::memory_order_relaxed));
+          break;
+        }
+        link = &node->next;
+      }
+    }
+
+    if (node == nullptr) {
+      return false;
+    }
+
+    size_.fetch_sub(1, std::memory_order_relaxed);
+
+    // Wait for any lookups that might still be traversing the node
+    // (but not for any borrows) before letting it be destructed.
+    Lookups::Wait();
+
+    // NOTE: 'Orphan()' might destruct (and deallocate) the node
+    // before it returns.
+    node->Orphan();
+
+    return true;
+  }
+
+ private:
+  // Grace period domain for lookups, see above.
+  using Lookups = GracePeriodDomain<BorrowableMap>;
+
+  class Node final : public Borrowable<V> {
+   public:
+    template <typename... Args>
+    Node(const K& key, size_t hash, Args&&... args)
+      : Borrowable<V>(std::forward<Args>(args)...),
+        key(key),
+        hash(hash) {}
+
+    const K key;
+    const size_t hash;
+
+    std::atomic<Node*> next = nullptr;
+  };
+
+  struct alignas(64) Stripe {
+    std::mutex mutex;
+  };
+
+  // Rounds up to a power of 2 so buckets can be found by masking.
+  static size_t Round(size_t buckets) {
+    size_t rounded = 1;
+    while (rounded < buckets) {
+      rounded *= 2;
+    }
+    return rounded;
+  }
+
+  std::atomic<Node*>& BucketFor(size_t hash) {
+    return buckets_[hash & mask_];
+  }
+
+  Stripe& StripeFor(size_t hash) {
+    return stripes_[hash & mask_ & (kStripes - 1)];
+  }
+
+  // Returns the node for 'key' in 'bucket' or nullptr if there isn't
+  // one. Must be called while holding the stripe lock or from within
+  // a read-side critical section.
+  Node* Find(std::atomic<Node*>& bucket, size_t hash, const K& key) {
+    for (Node* node = bucket.load(std::memory_order_acquire);
+         node != nullptr;
+         node = node->next.load(std::memory_order_acquire)) {
+      if (node->hash == hash && equal_(node->key, key)) {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  Hash hash_;
+  Equal equal_;
+
+  std::unique_ptr<std::atomic<Node*>[]> buckets_;
+  const size_t mask_;
+
+  Stripe stripes_[kStripes];
+
+  std::atomic<size_t> size_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <utility>
+
+#include "glog/logging.h"
+#include "stout/borrowed_ptr.h"
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// Owns a heap allocated 'Borrowable<T, Policy>' but unlike a
+// 'Borrowable' (or a 'std::unique_ptr<Borrowable>') destructing (or
+// calling 'reset()' on) a 'borrowable_owner' never waits for
+// outstanding borrows to be relinquished. Instead the borrowable
+// (and its 'T') gets destructed and deallocated by whichever thread
+// relinquishes the last borrow (or immediately if there aren't any
+// borrows).
+//
+// Just like when destructing a 'Borrowable' it's an error to be
+// watching (see 'Watch()') when destructing (or calling 'reset()').
+// Draining (see 'Drain()') is fine though: the drain callback still
+// gets invoked once the last borrow has been relinquished, right
+// before the borrowable gets destructed.
+template <typename T, typename Policy = Atomic>
+class borrowable_owner final {
+ public:
+  borrowable_owner() {}
+
+  template <typename... Args>
+  explicit borrowable_owner(std::in_place_t, Args&&... args)
+    : borrowable_(
+        new Borrowable<T, Policy>(std::forward<Args>(args)...)) {}
+
+  borrowable_owner(const borrowable_owner& that) = delete;
+
+  borrowable_owner(borrowable_owner&& that) {
+    std::swap(borrowable_, that.borrowable_);
+  }
+
+  ~borrowable_owner() {
+    reset();
+  }
+
+  borrowable_owner& operator=(borrowable_owner&& that) {
+    reset();
+    std::swap(borrowable_, that.borrowable_);
+    return *this;
+  }
+
+  explicit operator bool() const {
+    return borrowable_ != nullptr;
+  }
+
+  // Gives up ownership without waiting for any outstanding borrows.
+  void reset() {
+    if (borrowable_ != nullptr) {
+      // NOTE: 'Orphan()' might destruct (and deallocate) the
+      // borrowable before it returns.
+      std::exchange(borrowable_, nullptr)->Orphan();
+    }
+  }
+
+  borrowed_ref<T> Borrow(
+      const SourceLocation& location = SourceLocation::current()) {
+    return CHECK_NOTNULL(borrowable_)->Borrow(location);
+  }
+
+  borrowed_ptr<T> TryBorrow(
+      const SourceLocation& location = SourceLocation::current()) {
+    return CHECK_NOTNULL(borrowable_)->TryBorrow(location);
+  }
+
+  borrowed_compact_ptr<T, Policy> BorrowCompact(
+      const SourceLocation& location = SourceLocation::current()) {
+    return CHECK_NOTNULL(borrowable_)->BorrowCompact(location);
+  }
+
+  borrowed_read_ref<T> Read() {
+    return CHECK_NOTNULL(borrowable_)->Read();
+  }
+
+  borrowed_batch<T> Borrow(size_t n) {
+    return CHECK_NOTNULL(borrowable_)->Borrow(n);
+  }
+
+  borrowed_lease<T> Lease(size_t credits) {
+    return CHECK_NOTNULL(borrowable_)->Lease(credits);
+  }
+
+  template <
+      typename F,
+      std::enable_if_t<!std::is_integral_v<std::decay_t<F>>, int> = 0>
+  borrowed_callable<F> Borrow(
+      F&& f,
+      const SourceLocation& location = SourceLocation::current()) {
+    return CHECK_NOTNULL(borrowable_)->Borrow(std::forward<F>(f), location);
+  }
+
+  template <typename F>
+  bool Watch(F&& f) {
+    return CHECK_NOTNULL(borrowable_)->Watch(std::forward<F>(f));
+  }
+
+  template <typename E, typename F>
+  bool Watch(E& executor, F&& f) {
+    return CHECK_NOTNULL(borrowable_)->Watch(executor, std::forward<F>(f));
+  }
+
+  template <typename F>
+  bool Drain(F&& f) {
+    return CHECK_NOTNULL(borrowable_)->Drain(std::forward<F>(f));
+  }
+
+  template <typename E, typename F>
+  bool Drain(E& executor, F&& f) {
+    return CHECK_NOTNULL(borrowable_)->Drain(executor, std::forward<F>(f));
+  }
+
+  template <typename E>
+  void SetDefaultExecutor(E& executor) {
+    CHECK_NOTNULL(borrowable_)->SetDefaultExecutor(executor);
+  }
+
+  void LimitBorrows(size_t limit) {
+    CHECK_NOTNULL(borrowable_)->LimitBorrows(limit);
+  }
+
+  template <typename F>
+  bool WatchBorrowsBelow(size_t borrows, F&& f) {
+    return CHECK_NOTNULL(borrowable_)
+        ->WatchBorrowsBelow(borrows, std::forward<F>(f));
+  }
+
+  size_t borrows() const {
+    return CHECK_NOTNULL(borrowable_)->borrows();
+  }
+
+  T* get() const {
+    return borrowable_ != nullptr ? borrowable_->get() : nullptr;
+  }
+
+  T* operator->() const {
+    return CHECK_NOTNULL(get());
+  }
+
+  T& operator*() const {
+    return *CHECK_NOTNULL(get());
+  }
+
+ private:
+  Borrowable<T, Policy>* borrowable_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename Policy = Atomic, typename... Args>
+borrowable_owner<T, Policy> make_borrowable_owner(Args&&... args) {
+  return borrowable_owner<T, Policy>(
+      std::in_place,
+      std::forward<Args>(args)...);
+}
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+#include "stout/borrowed_ptr.h"
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// A pool of 'Borrowable<T>' for objects that are only ever accessed
+// through borrows and get constructed and destructed at a high rate,
+// e.g., per request contexts. 'Make()' constructs a 'T' in place in a
+// free slot and returns a borrow of it, and once the last borrow gets
+// relinquished the 'T' gets destructed and its slot gets recycled by
+// the relinquishing thread, i.e., just like with a 'borrowable_owner'
+// that has been reset nothing ever waits for borrows to be
+// relinquished.
+//
+// Slots are cache line aligned and allocated in slabs. Each thread
+// keeps its own list of free slots so that making and recycling
+// doesn't need any atomic operations besides those for borrowing.
+// Only when a thread's free list gets too long (e.g., because slots
+// get made on one thread but recycled on another) does it hand all
+// of its slots over to a shared free list, which threads take from
+// when their own free list is empty. A new slab only gets allocated
+// when there aren't any free slots, so in steady state neither
+// making nor recycling allocates. When a thread exits its free slots
+// get handed over to the shared free list too and its cache gets used
+// again by the next thread that needs one, so threads coming and
+// going neither strand slots nor grow the pool.
+//
+// NOTE: slots only get deallocated when the pool is destructed which
+// must be after every borrow of every 'T' has been relinquished.
+template <typename T>
+class BorrowablePool final {
+ public:
+  // Number of slots allocated at once.
+  static constexpr size_t kSlabSlots = 64;
+
+  // Maximum number of free slots a thread keeps before handing them
+  // over to the shared free list.
+  static constexpr size_t kMaxFreeSlots = 4 * kSlabSlots;
+
+  BorrowablePool() {}
+
+  // Slots point back at their pool so it can be neither copied nor
+  // moved.
+  BorrowablePool(const BorrowablePool&) = delete;
+  BorrowablePool(BorrowablePool&&) = delete;
+
+  ~BorrowablePool() {
+    // Stop any exiting threads from releasing their caches, see
+    // 'Registrations'.
+    {
+      std::lock_guard<std::mutex> lock(lifetime_->mutex);
+      lifetime_->alive.store(false);
+    }
+
+    int64_t outstanding = 0;
+    for (Cache* cache = caches_.load();
+         cache != nullptr;
+         cache = cache->next) {
+      outstanding += cache->outstanding;
+    }
+
+    CHECK_EQ(outstanding, 0)
+        << "Destructing a pool with outstanding borrows";
+
+    Cache* cache = caches_.load();
+    while (cache != nullptr) {
+      delete std::exchange(cache, cache->next);
+    }
+  }
+
+  BorrowablePool& operator=(const BorrowablePool&) = delete;
+  BorrowablePool& operator=(BorrowablePool&&) = delete;
+
+  // Constructs a 'T' from 'args' in a free slot and returns the only
+  // borrow of it, see above.
+  template <typename... Args>
+  borrowed_ref<T> Make(Args&&... args) {
+    Cache& cache = Local();
+
+    Slot* slot = Allocate(cache);
+
+    auto* pooled = new (&slot->storage)
+        Pooled(this, slot, std::forward<Args>(args)...);
+
+    cache.outstanding++;
+
+    // Orphaning means the last relinquish will recycle the slot, see
+    // 'Pooled::Reclaim()'.
+    return pooled->BorrowOrphaned();
+  }
+
+  // Returns the number of slots that have been allocated, i.e., the
+  // most 'T' there have been at once (rounded up to a whole slab).
+  size_t capacity() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return slabs_.size() * kSlabSlots;
+  }
+
+ private:
+  struct Slot;
+
+  class Pooled final : public Borrowable<T> {
+   public:
+    template <typename... Args>
+    Pooled(BorrowablePool* pool, Slot* slot, Args&&... args)
+      : Borrowable<T>(std::forward<Args>(args)...),
+        pool_(pool),
+        slot_(slot) {}
+
+    using Borrowable<T>::BorrowOrphaned;
+
+   private:
+    void Reclaim() override {
+      BorrowablePool* pool = pool_;
+      Slot* slot = slot_;
+
+      this->~Pooled();
+
+      pool->Recycle(slot);
+    }
+
+    BorrowablePool* pool_ = nullptr;
+    Slot* slot_ = nullptr;
+  };
+
+  struct alignas(64) Slot {
+    alignas(Pooled) unsigned char storage[sizeof(Pooled)];
+
+    Slot* next = nullptr;
+  };
+
+  // Each thread's free slots, only ever accessed by the thread using
+  // it except when destructing the pool.
+  struct alignas(64) Cache {
+    // Whether or not a thread is using this cache, see 'Release()'.
+    std::atomic<bool> used = true;
+
+    Cache* next = nullptr;
+
+    Slot* free = nullptr;
+    Slot* tail = nullptr;
+    size_t size = 0;
+
+    // Made minus recycled on this thread.
+    int64_t outstanding = 0;
+  };
+
+  Slot* Allocate(Cache& cache) {
+    if (cache.free == nullptr) {
+      // Take all of the slots that other threads have handed over
+      // (or allocate a new slab if there aren't any).
+      Slot* slots = shared_.exchange(nullptr);
+      if (slots == nullptr) {
+        slots = AllocateSlab();
+      }
+
+      cache.free = slots;
+      cache.size = 1;
+      while (slots->next != nullptr) {
+        slots = slots->next;
+        cache.size++;
+      }
+      cache.tail = slots;
+    }
+
+    Slot* slot = cache.free;
+    cache.free = slot->next;
+    cache.size--;
+    return slot;
+  }
+
+  void Recycle(Slot* slot) {
+    Cache& cache = Local();
+
+    cache.outstanding--;
+
+    slot->next = cache.free;
+    if (cache.free == nullptr) {
+      cache.tail = slot;
+    }
+    cache.free = slot;
+    cache.size++;
+
+    if (cache.size > kMaxFreeSlots) {
+      Share(cache);
+    }
+  }
+
+  // Hands all of the free slots of 'cache' over to the shared free
+  // list.
+  void Share(Cache& cache) {
+    // NOTE: the shared free list only ever gets pushed to or taken
+    // all at once so it's not susceptible to ABA.
+    cache.tail->next = shared_.load();
+    while (!shared_.compare_exchange_weak(cache.tail->next, cache.free)) {}
+
+    cache.free = nullptr;
+    cache.tail = nullptr;
+    cache.size = 0;
+  }
+
+  // Invoked when the thread using 'cache' exits so that its free
+  // slots can be taken by other threads and the cache itself can be
+  // used by the next thread that needs one, see 'Find()'.
+  void Release(Cache& cache) {
+    if (cache.free != nullptr) {
+      Share(cache);
+    }
+
+    cache.used.store(false);
+  }
+
+  // Returns a list of new slots.
+  Slot* AllocateSlab() {
+    auto slab = std::make_unique<Slot[]>(kSlabSlots);
+
+    for (size_t i = 0; i < kSlabSlots - 1; i++) {
+      slab[i].next = &slab[i + 1];
+    }
+
+    Slot* slots = &slab[0];
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    slabs_.push_back(std::move(slab));
+
+    return slots;
+  }
+
+  Cache& Local() {
+    // Most threads only ever use a single pool (per 'T') so we
+    // remember the last one to avoid looking up the cache each time.
+    struct Last {
+      uint64_t id = 0;
+      Cache* cache = nullptr;
+    };
+
+    static thread_local Last last;
+
+    if (last.id != id_) {
+      last.cache = &Find();
+      last.id = id_;
+    }
+
+    return *last.cache;
+  }
+
+  // Returns the calling thread's cache, adding it if necessary by
+  // using one that was released by a thread that has exited if
+  // possible, see 'Release()', so that there are never more caches
+  // than there have been threads using the pool at once.
+  Cache& Find() {
+    for (auto& registration : LocalRegistrations().registrations) {
+      if (registration.lifetime == lifetime_) {
+        return *registration.cache;
+      }
+    }
+
+    for (Cache* cache = caches_.load();
+         cache != nullptr;
+         cache = cache->next) {
+      bool used = false;
+      if (!cache->used.load()
+          && cache->used.compare_exchange_strong(used, true)) {
+        Register(*cache);
+        return *cache;
+      }
+    }
+
+    Cache* cache = new Cache();
+    cache->next = caches_.load();
+    while (!caches_.compare_exchange_weak(cache->next, cache)) {}
+
+    Register(*cache);
+    return *cache;
+  }
+
+  // Whether or not the pool still exists, which exiting threads must
+  // check before releasing their caches.
+  struct Lifetime {
+    std::mutex mutex;
+    std::atomic<bool> alive = true;
+  };
+
+  // Releases the caches of a thread when it exits, see 'Release()'.
+  //
+  // NOTE: relinquishing the last borrow of a 'T' from a 'thread_local'
+  // destructor that runs after this one (on the same thread) is not
+  // supported.
+  struct Registrations {
+    struct Registration {
+      std::shared_ptr<Lifetime> lifetime;
+      BorrowablePool* pool = nullptr;
+      Cache* cache = nullptr;
+    };
+
+    ~Registrations() {
+      for (auto& registration : registrations) {
+        std::lock_guard<std::mutex> lock(registration.lifetime->mutex);
+        if (registration.lifetime->alive.load()) {
+          registration.pool->Release(*registration.cache);
+        }
+      }
+    }
+
+    std::vector<Registration> registrations;
+  };
+
+  static Registrations& LocalRegistrations() {
+    static thread_local Registrations registrations;
+    return registrations;
+  }
+
+  void Register(Cache& cache) {
+    auto& registrations = LocalRegistrations().registrations;
+
+    // Forget about any pools that have been destructed.
+    registrations.erase(
+        std::remove_if(
+            registrations.begin(),
+            registrations.end(),
+            [](const auto& registration) {
+              return !registration.lifetime->alive.load();
+            }),
+        registrations.end());
+
+    registrations.push_back({lifetime_, this, &cache});
+  }
+
+  static uint64_t NextId() {
+    static std::atomic<uint64_t> ids = 1;
+    return ids.fetch_add(1);
+  }
+
+  // Unique for every pool (unlike its address) so a thread can't
+  // mistake a cache of a destructed pool for one of this pool.
+  const uint64_t id_ = NextId();
+
+  const std::shared_ptr<Lifetime> lifetime_ = std::make_shared<Lifetime>();
+
+  std::atomic<Cache*> caches_ = nullptr;
+  std::atomic<Slot*> shared_ = nullptr;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Slot[]>> slabs_;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,214 @@
+#pragma once
+
+// Statistics for borrowables are only collected when compiled with
+// 'STOUT_BORROWABLE_STATS' defined, otherwise everything in this file
+// is empty (or a no-op) and has no cost.
+
+#ifdef STOUT_BORROWABLE_STATS
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <typeinfo>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+#ifdef STOUT_BORROWABLE_STATS
+
+// Statistics for a single borrowable. Every instance registers itself
+// in a process-wide registry for as long as it's alive so that the
+// statistics of all borrowables can be dumped, e.g., to find
+// borrowables whose destruction has stalled.
+//
+// All statistics are updated with relaxed atomics since they're only
+// ever meant to be approximate.
+class BorrowableStats final {
+ public:
+  // Borrow lifetimes are recorded in buckets of powers of two
+  // nanoseconds, i.e., bucket 'i' counts borrows that lived for less
+  // than 2^i nanoseconds (and the last bucket counts the rest).
+  static constexpr size_t kLifetimeBuckets = 40;
+
+  BorrowableStats(const void* borrowable)
+    : borrowable_(borrowable) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    next_ = registry().head;
+    if (next_ != nullptr) {
+      next_->previous_ = this;
+    }
+    registry().head = this;
+  }
+
+  BorrowableStats(const BorrowableStats&) = delete;
+
+  ~BorrowableStats() {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    if (previous_ != nullptr) {
+      previous_->next_ = next_;
+    } else {
+      registry().head = next_;
+    }
+    if (next_ != nullptr) {
+      next_->previous_ = previous_;
+    }
+  }
+
+  void type(const char* type) {
+    type_.store(type, std::memory_order_relaxed);
+  }
+
+  // Records 'n' new borrows now that there are 'count' borrows.
+  void Borrowed(size_t n, size_t count) {
+    borrows_.fetch_add(n, std::memory_order_relaxed);
+    borrowing_.store(count, std::memory_order_relaxed);
+
+    size_t peak = peak_.load(std::memory_order_relaxed);
+    while (count > peak
+           && !peak_.compare_exchange_weak(
+               peak,
+               count,
+               std::memory_order_relaxed)) {}
+  }
+
+  // Records the lifetime of a borrow that was borrowed at
+  // 'borrowed' and just got relinquished.
+  void Relinquished(std::chrono::steady_clock::time_point borrowed) {
+    auto lifetime = std::chrono::steady_clock::now() - borrowed;
+
+    uint64_t nanoseconds = std::chrono::duration_cast<
+                               std::chrono::nanoseconds>(lifetime)
+                               .count();
+
+    size_t bucket = 0;
+    while (bucket < kLifetimeBuckets - 1
+           && (uint64_t(1) << bucket) <= nanoseconds) {
+      bucket++;
+    }
+
+    lifetimes_[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Records 'retries' of a compare-and-swap on the tally.
+  void Retried(size_t retries) {
+    if (retries > 0) {
+      retries_.fetch_add(retries, std::memory_order_relaxed);
+    }
+  }
+
+  // Records that we've started waiting for borrows to be
+  // relinquished, returning when so it can be passed to 'Waited()'.
+  std::chrono::steady_clock::time_point Waiting() {
+    auto now = std::chrono::steady_clock::now();
+    waiting_since_.store(
+        now.time_since_epoch().count(),
+        std::memory_order_relaxed);
+    return now;
+  }
+
+  void Waited(std::chrono::steady_clock::time_point since) {
+    auto waited = std::chrono::steady_clock::now() - since;
+    waits_.fetch_add(1, std::memory_order_relaxed);
+    waited_.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count(),
+        std::memory_order_relaxed);
+    waiting_since_.store(0, std::memory_order_relaxed);
+  }
+
+  // Records that a thread waiting for borrows to be relinquished
+  // stopped spinning and parked.
+  void Parked() {
+    parks_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Dumps the statistics of all live borrowables, one per line.
+  static void Dump(std::ostream& os) {
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    for (auto* stats = registry().head;
+         stats != nullptr;
+         stats = stats->next_) {
+      stats->Print(os);
+      os << '\n';
+    }
+  }
+
+ private:
+  void Print(std::ostream& os) const {
+    const char* type = type_.load(std::memory_order_relaxed);
+
+    os << borrowable_
+       << " type=" << (type != nullptr ? type : "?")
+       << " borrowing=" << borrowing_.load(std::memory_order_relaxed)
+       << " borrows=" << borrows_.load(std::memory_order_relaxed)
+       << " peak=" << peak_.load(std::memory_order_relaxed)
+       << " retries=" << retries_.load(std::memory_order_relaxed)
+       << " waits=" << waits_.load(std::memory_order_relaxed)
+       << " waited_ns=" << waited_.load(std::memory_order_relaxed)
+       << " parks=" << parks_.load(std::memory_order_relaxed);
+
+    auto since = waiting_since_.load(std::memory_order_relaxed);
+    if (since != 0) {
+      auto waiting = std::chrono::steady_clock::now().time_since_epoch()
+          - std::chrono::steady_clock::duration(since);
+      os << " waiting_ns="
+         << std::chrono::duration_cast<std::chrono::nanoseconds>(waiting)
+                .count();
+    }
+
+    // Only print the non-empty lifetime buckets as 'bucket:count'.
+    os << " lifetimes_log2_ns=[";
+    bool first = true;
+    for (size_t bucket = 0; bucket < kLifetimeBuckets; bucket++) {
+      auto count = lifetimes_[bucket].load(std::memory_order_relaxed);
+      if (count > 0) {
+        os << (first ? "" : " ") << bucket << ":" << count;
+        first = false;
+      }
+    }
+    os << "]";
+  }
+
+  struct Registry {
+    std::mutex mutex;
+    BorrowableStats* head = nullptr;
+  };
+
+  static Registry& registry() {
+    static Registry* registry = new Registry();
+    return *registry;
+  }
+
+  const void* borrowable_ = nullptr;
+
+  std::atomic<const char*> type_ = nullptr;
+
+  // NOTE: 'borrowing_' is the number of borrows as of the last
+  // borrow, not necessarily the current number of borrows.
+  std::atomic<size_t> borrowing_ = 0;
+  std::atomic<size_t> borrows_ = 0;
+  std::atomic<size_t> peak_ = 0;
+  std::atomic<size_t> retries_ = 0;
+  std::atomic<size_t> waits_ = 0;
+  std::atomic<uint64_t> waited_ = 0;
+  std::atomic<size_t> parks_ = 0;
+  std::atomic<std::chrono::steady_clock::rep> waiting_since_ = 0;
+  std::array<std::atomic<size_t>, kLifetimeBuckets> lifetimes_ = {};
+
+  // Protected by 'registry().mutex'.
+  BorrowableStats* previous_ = nullptr;
+  BorrowableStats* next_ = nullptr;
+};
+
+#endif // STOUT_BORROWABLE_STATS
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
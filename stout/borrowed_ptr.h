@@ -1,12 +1,44 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "glog/logging.h"
+#include "stout/atomic-backoff.h"
+#include "stout/borrow_tracking.h"
+#include "stout/borrowable_stats.h"
+#include "stout/grace_period.h"
+#include "stout/inline_callback.h"
 #include "stout/stateful-tally.h"
 
 ////////////////////////////////////////////////////////////////////////
 
+// Number of bytes available for storing a watch callback (see
+// 'TypeErasedBorrowable::Watch()') inline. Regardless of this value
+// there is always enough room for a 'std::function<void()>' so that
+// wrapping a callback in a 'std::function' can be used as an explicit
+// fallback for callbacks that are too big.
+#ifndef STOUT_BORROWABLE_WATCH_CAPACITY
+#define STOUT_BORROWABLE_WATCH_CAPACITY (4 * sizeof(void*))
+#endif
+
+////////////////////////////////////////////////////////////////////////
+
 namespace stout {
 
 ////////////////////////////////////////////////////////////////////////
@@ -18,77 +50,544 @@ class borrowed_ref;
 template <typename T>
 class borrowed_ptr;
 
+template <typename T>
+class borrowed_read_ref;
+
+template <typename T>
+class borrowed_batch;
+
+template <typename T>
+class borrowed_span;
+
+template <typename T>
+class borrowed_lease;
+
+template <typename T>
+class borrowed_weak;
+
+template <typename T>
+class borrowed_exclusive_ptr;
+
 template <typename F>
 class borrowed_callable;
 
+template <typename T, typename Policy>
+class borrowed_compact_ptr;
+
+template <typename T, typename Policy>
+class borrowable_owner;
+
+template <typename K, typename V, typename Hash, typename Equal>
+class BorrowableMap;
+
+////////////////////////////////////////////////////////////////////////
+
+// Policies for how a 'Borrowable' (or 'enable_borrowable_from_this')
+// counts its borrows.
+//
+// 'Atomic' (the default) keeps every borrow in a single
+// 'StatefulTally' which is the cheapest option as long as the
+// borrows are not heavily contended.
+//
+// 'Sharded' spreads borrows and relinquishes across cache line
+// aligned per-thread shards so that concurrent borrowers on
+// different cores don't bounce a single cache line back and
+// forth. The shards get folded back into the tally whenever the true
+// count is needed, i.e., when calling 'Watch()' or
+// 'WaitUntilBorrowsEquals()', when moving and when destructing. The
+// shards get used again once a watch callback has been invoked (or
+// after waiting or moving) but stay folded after destruction has
+// started.
+//
+// 'Biased' is for borrowables that are mostly borrowed and
+// relinquished on the thread that constructed them (the "owning"
+// thread), e.g., an event loop thread. The owning thread counts its
+// borrows without any atomic read-modify-write operations while all
+// other threads use a single shared atomic shard. Just like with
+// 'Sharded' the owning thread's count and the shared shard get folded
+// back into the tally whenever the true count is needed, but since
+// only the owning thread can read its count this must always happen
+// on the owning thread, i.e., a 'Biased' borrowable must be watched,
+// moved and destructed on the thread that constructed it.
+//
+// 'SingleThreaded' is for borrowables that are only ever used from
+// the thread that constructed them, e.g., for lifetime safety within
+// a single event loop. Borrows are counted with a plain integer which
+// is only folded back into the tally when watching, moving or
+// destructing (just like 'Biased'). Using a 'SingleThreaded'
+// borrowable from any other thread is an error that is only checked
+// in debug builds, and since no other thread could ever relinquish a
+// borrow, waiting for borrows to be relinquished (i.e., moving or
+// destructing while there are outstanding borrows) is always fatal.
+struct Atomic {};
+
+struct Sharded {};
+
+struct Biased {};
+
+struct SingleThreaded {};
+
+// Wraps any of the above policies to put the borrowed 'T' on its own
+// cache line(s), e.g., 'Borrowable<T, CacheAligned<Sharded>>', so
+// that borrowing and relinquishing (which write to the tally) don't
+// keep invalidating the cache line of threads that are reading 'T'
+// (i.e., false sharing). This costs up to a cache line of padding
+// before (and after) 'T' which is only worth it for small 'T' that
+// are read often while also being borrowed from other threads.
+template <typename Policy = Atomic>
+struct CacheAligned {};
+
+template <typename Policy>
+struct IsCacheAligned : std::false_type {};
+
+template <typename Policy>
+struct IsCacheAligned<CacheAligned<Policy>> : std::true_type {};
+
+// Puts whatever follows it on its own cache line when 'padded' by
+// taking up a cache line itself (which, unlike aligning a class,
+// can't be reused by the members of a derived class).
+template <bool padded>
+struct CacheLinePadding {};
+
+template <>
+struct CacheLinePadding<true> {
+  alignas(64) unsigned char padding;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// Remembers when (see 'STOUT_BORROWABLE_STATS') and where (see
+// 'STOUT_BORROWABLE_TRACKING') a borrow was made so that it can be
+// accounted for when it gets relinquished. Borrows (e.g.,
+// 'borrowed_ptr') privately inherit from this so that it takes up no
+// space when neither statistics nor tracking are enabled.
+struct BorrowDiagnostics {
+  const BorrowDiagnostics& diagnostics() const {
+    return *this;
+  }
+
+  // Returns where the borrow was made if it's being tracked.
+  SourceLocation location() const {
+#ifdef STOUT_BORROWABLE_TRACKING
+    if (record != nullptr) {
+      return record->location();
+    }
+#endif
+    return SourceLocation();
+  }
+
+#ifdef STOUT_BORROWABLE_STATS
+  std::chrono::steady_clock::time_point borrowed =
+      std::chrono::steady_clock::now();
+#endif
+
+#ifdef STOUT_BORROWABLE_TRACKING
+  BorrowTracking::Record* record = nullptr;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////
+
+class TypeErasedBorrowable;
+
+// Defers relinquishing borrows on the calling thread for as long as
+// the outermost 'DeferRelinquish' exists, e.g., for a hot loop that
+// keeps borrowing (and relinquishing) the same few borrowables:
+//
+//   {
+//     DeferRelinquish defer;
+//     for (...) {
+//       borrowed_ptr<T> borrowed = borrowable.Borrow();
+//       ...
+//     } // Deferred rather than relinquished.
+//   } // Relinquishes all of the deferred borrows at once.
+//
+// Deferred relinquishes are merged per borrowable in a small
+// thread-local table so that each borrowable only needs a single
+// atomic operation to relinquish all of its deferred borrows when
+// flushing, which happens when the outermost 'DeferRelinquish' gets
+// destructed or when calling 'Flush()', e.g., at a batch boundary.
+// Once the table is full any other borrowables get relinquished
+// right away as usual.
+//
+// Deferred borrows are still outstanding borrows, i.e., a 'Watch()'
+// callback doesn't get invoked (and a destructor doesn't return)
+// until they have been flushed. Watching, draining or waiting for
+// borrows (which includes destructing) first flushes any of the
+// calling thread's deferred borrows of that borrowable but waits for
+// other threads to flush theirs, so a thread must not block on
+// anything that might be waiting for borrows while deferring.
+class DeferRelinquish final {
+ public:
+  // Maximum number of borrowables a thread defers at once.
+  static constexpr size_t kCapacity = 16;
+
+  DeferRelinquish() {
+    if (Local().scopes++ == 0) {
+      Deferring().fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  DeferRelinquish(const DeferRelinquish&) = delete;
+  DeferRelinquish(DeferRelinquish&&) = delete;
+
+  ~DeferRelinquish() {
+    if (--Local().scopes == 0) {
+      Flush();
+      Deferring().fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  DeferRelinquish& operator=(const DeferRelinquish&) = delete;
+  DeferRelinquish& operator=(DeferRelinquish&&) = delete;
+
+  // Relinquishes all of the calling thread's deferred borrows.
+  static void Flush();
+
+ private:
+  friend class TypeErasedBorrowable;
+
+  struct Deferred {
+    TypeErasedBorrowable* borrowable = nullptr;
+    size_t borrows = 0;
+  };
+
+  struct Table {
+    size_t scopes = 0;
+    size_t size = 0;
+    Deferred deferred[kCapacity];
+  };
+
+  static Table& Local() {
+    static thread_local Table table;
+    return table;
+  }
+
+  // Number of threads that are currently deferring so that
+  // relinquishing (and flushing) can skip looking up the calling
+  // thread's table when no thread is deferring. A relaxed load is
+  // enough since a deferring thread always sees its own increment.
+  static std::atomic<size_t>& Deferring() {
+    static std::atomic<size_t> deferring(0);
+    return deferring;
+  }
+
+  // Defers relinquishing a single borrow of 'borrowable', returns
+  // false if the calling thread isn't deferring (or its table is
+  // full) in which case the caller must relinquish.
+  static bool Defer(TypeErasedBorrowable* borrowable) {
+    if (Deferring().load(std::memory_order_relaxed) == 0) {
+      return false;
+    }
+
+    Table& table = Local();
+
+    if (table.scopes == 0) {
+      return false;
+    }
+
+    for (size_t i = 0; i < table.size; i++) {
+      if (table.deferred[i].borrowable == borrowable) {
+        table.deferred[i].borrows++;
+        return true;
+      }
+    }
+
+    if (table.size == kCapacity) {
+      return false;
+    }
+
+    table.deferred[table.size++] = Deferred{borrowable, 1};
+
+    return true;
+  }
+
+  // Relinquishes the calling thread's deferred borrows of just
+  // 'borrowable' (if any).
+  static void Flush(TypeErasedBorrowable* borrowable);
+};
+
 ////////////////////////////////////////////////////////////////////////
 
-// NOTE: currently this implementation of Borrowable does an atomic
-// backoff instead of blocking the thread when the destructor waits
-// for all borrows to be relinquished. This will be much less
-// efficient (and hold up a CPU) if the borrowers take a while to
-// relinquish. However, since Borrowable will mostly be used in
-// cirumstances where the tally is definitely back to 0 when we wait
-// no backoff will occur. For circumstances where Borrowable is being
-// used to wait until work is completed consider using a Notification
-// to be notified when the work is complete and then Borrowable should
-// destruct without any atomic backoff (because any workers/threads
-// will have relinquished).
+// NOTE: when the destructor (or the move constructor) waits for all
+// borrows to be relinquished it first does a short atomic backoff
+// and then parks the thread until the last borrow gets relinquished.
+// Since Borrowable will mostly be used in cirumstances where the tally
+// is definitely back to 0 when we wait no backoff or parking will
+// occur, and relinquishing only needs to check for a parked thread
+// when the tally gets back to 0. For circumstances where Borrowable
+// is being used to wait until work is completed consider using a
+// Notification to be notified when the work is complete and then
+// Borrowable should destruct without waiting at all (because any
+// workers/threads will have relinquished).
 class TypeErasedBorrowable {
  public:
+  // Invokes 'f' once all outstanding borrows have been relinquished
+  // (immediately if there aren't any). Returns false if already being
+  // watched or if draining (or drained), see 'Drain()'.
   template <typename F>
   bool Watch(F&& f) {
+    return WatchOn(DefaultExecutor(), std::forward<F>(f));
+  }
+
+  // Like 'Watch(f)' except 'f' gets submitted to 'executor' rather
+  // than invoked by whichever thread relinquishes the last borrow,
+  // e.g., so that a latency sensitive thread only ever has to submit
+  // 'f' rather than run expensive cleanup. An executor is anything
+  // with a 'Submit()' that takes a move-only 'void()' callable, e.g.,
+  // a 'ThreadPool', and must outlive the watch.
+  template <typename E, typename F>
+  bool Watch(E& executor, F&& f) {
+    return WatchOn(Executor::For(executor), std::forward<F>(f));
+  }
+
+  // Sets the executor that 'Watch(f)' and 'Drain(f)' submit 'f' to,
+  // see 'Watch(executor, f)', which must be set before watching (or
+  // draining) and must outlive this borrowable.
+  template <typename E>
+  void SetDefaultExecutor(E& executor) {
+    Extend().default_executor = Executor::For(executor);
+  }
+
+  // Starts draining: no new borrows can be made, i.e., 'Borrow()' is
+  // an error and 'TryBorrow()' returns an empty 'borrowed_ptr', and
+  // 'f' gets invoked once all outstanding borrows have been
+  // relinquished (immediately if there aren't any). Outstanding
+  // borrows can still be reborrowed while draining.
+  //
+  // Unlike 'Watch()' a borrowable stays drained after 'f' has been
+  // invoked, i.e., it can never be borrowed again, it can only be
+  // destructed (which waits for draining to finish if it hasn't
+  // yet). Returns false if already draining (or drained).
+  //
+  // If being watched then draining takes over the watch: the watch
+  // callback still gets invoked, right before 'f', once all
+  // outstanding borrows have been relinquished.
+  template <typename F>
+  bool Drain(F&& f) {
+    return DrainOn(DefaultExecutor(), std::forward<F>(f));
+  }
+
+  // Like 'Drain(f)' except 'f' gets submitted to 'executor', see
+  // 'Watch(executor, f)'.
+  template <typename E, typename F>
+  bool Drain(E& executor, F&& f) {
+    return DrainOn(Executor::For(executor), std::forward<F>(f));
+  }
+
+  // Limits how many borrows 'TryBorrow()' will make to 'limit', e.g.,
+  // to use a borrowable to limit the amount of in-flight work. Only
+  // 'TryBorrow()' is limited: 'Borrow()' and reborrowing always
+  // succeed so that work that has already been admitted can always
+  // borrow again.
+  //
+  // NOTE: the first call must happen before the borrowable has been
+  // borrowed (or shared with other threads) but afterwards the limit
+  // can be changed at any time. A limited borrowable counts every
+  // borrow in the tally regardless of its policy (i.e., 'Sharded',
+  // 'Biased' and 'SingleThreaded' no longer apply) since each borrow
+  // needs to be checked against the limit.
+  void LimitBorrows(size_t limit) {
+    if (!limited_) {
+      Fold();
+
+      CHECK_EQ(tally_.count(), 0u)
+          << "Borrowables must be limited before being borrowed";
+
+      shards_.reset();
+      shards_mask_ = 0;
+      biased_ = false;
+      single_threaded_ = false;
+
+      Extend();
+
+      limited_ = true;
+    }
+
+    extension_.load()->limit.store(limit, std::memory_order_relaxed);
+  }
+
+  // Invokes 'f' once there are fewer than 'borrows' borrows, either
+  // immediately or from within the relinquish that would drop the
+  // borrows below 'borrows' (before that relinquish gets counted so
+  // it's safe for 'f' to access the borrowable). Only one callback
+  // can be armed at a time, returns false if one already is.
+  //
+  // While armed the borrowable holds an extra borrow of its own so
+  // that arming can't race with a concurrent relinquish (which would
+  // otherwise miss the callback), this borrow gets relinquished when
+  // 'f' gets invoked or when destructing (or moving, or orphaning)
+  // in which case 'f' never gets invoked.
+  //
+  // NOTE: only limited borrowables can be watched this way, see
+  // 'LimitBorrows()'.
+  template <typename F>
+  bool WatchBorrowsBelow(size_t borrows, F&& f) {
+    CHECK(limited_)
+        << "Only limited borrowables can watch for borrows below a "
+        << "threshold, see 'LimitBorrows()'";
+
+    CHECK_GT(borrows, 0u);
+    CHECK_NE(borrows, kArming);
+
+    Extension& extension = *extension_.load();
+
+    size_t below = 0;
+    if (!extension.below.compare_exchange_strong(below, kArming)) {
+      return false;
+    }
+
     auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
 
     do {
-      if (state == State::Watching) {
-        return false;
-      } else if (count == 0) {
+      if (state != State::Borrowing) {
+        extension.below.store(0);
+        LOG(FATAL) << "Attempting to watch borrows in state " << state;
+      } else if (count < borrows) {
+        extension.below.store(0);
         f();
         return true;
       }
+    } while (!tally_.Update(state, count, state, count + 1));
 
-      CHECK_EQ(state, State::Borrowing);
+    extension.below_watch = std::forward<F>(f);
 
-    } while (!tally_.Update(state, count, State::Watching, count + 1));
-
-    watch_ = std::move(f);
-
-    Relinquish();
+    extension.below.store(borrows);
 
     return true;
   }
 
+  // NOTE: only waiting for 0 borrows will park the thread, waiting
+  // for any other number of borrows always does an atomic backoff.
+  //
+  // Any shards get folded while waiting and then used again once
+  // we're done waiting (unless watching or draining by then).
   void WaitUntilBorrowsEquals(size_t borrows) {
-    tally_.Wait([&](auto /* state */, size_t count) {
-      return count == borrows;
-    });
+    Fold();
+
+    WaitUntilFoldedBorrowsEquals(borrows);
+
+    // Start using the shards again (if any) unless we're no longer
+    // 'Borrowing', see 'Unfold()'.
+    Unfold();
   }
 
+  // NOTE: when using 'Sharded' this is only a snapshot of the shards
+  // which might be stale if there are concurrent borrows.
   size_t borrows() {
-    return tally_.count();
+    if (shards_ != nullptr && sharding_.load() == Sharding::Sharded) {
+      int64_t count = tally_.count();
+      for (size_t i = 0; i <= shards_mask_; i++) {
+        count += shards_[i].count.load();
+      }
+      return count > 0 ? count : 0;
+    }
+
+    // Don't count the borrow held while watching for borrows below a
+    // threshold, see 'WatchBorrowsBelow()'.
+    size_t count = tally_.count();
+    if (limited_ && count > 0 && extension_.load()->below.load() != 0) {
+      count--;
+    }
+
+    // An exclusive borrow is only a single borrow, see
+    // 'IncrementExclusive()'.
+    if (count >= kExclusive) {
+      count -= kExclusive - 1;
+    }
+
+    return count;
+  }
+
+  // Relinquishes a single borrow, see 'BorrowDiagnostics', unless
+  // the calling thread is deferring relinquishes, see
+  // 'DeferRelinquish'.
+  void Relinquish(const BorrowDiagnostics& diagnostics) {
+    Untrack(diagnostics);
+    if (!DeferRelinquish::Defer(this)) {
+      Relinquish();
+    }
   }
 
-  void Relinquish() {
-    auto [state, count] = tally_.Decrement();
+  // Relinquishes 'borrows' at once, e.g., the remaining borrows of a
+  // 'borrowed_batch'.
+  void Relinquish(size_t borrows = 1) {
+    if (shards_ != nullptr && UpdateShard(-static_cast<int64_t>(borrows))) {
+      return;
+    }
+
+    auto [state, count] = limited_
+        ? DecrementLimited(borrows)
+        : borrows == 1
+        ? tally_.Decrement()
+        : Decrement(borrows);
+
+    if (count != 0) {
+      return;
+    }
 
-    if (state == State::Watching && count == 0) {
+    // NOTE: we can't access anything in 'this' until we know we're
+    // 'Watching' as the destructor (or the move constructor) might
+    // have already returned, hence we pass our address rather than
+    // have 'Unpark()' be a member function.
+    Unpark(this);
+
+    if (state == State::Watching) {
       // Move out 'watch_' in case it gets reset either in the
       // callback or because a concurrent call to 'borrow()' occurs
       // after we've updated the tally below.
       auto f = std::move(watch_);
-      watch_ = std::function<void()>();
+      Executor executor = WatchExecutor();
 
       tally_.Update(state, State::Borrowing);
 
+      // Start using the shards again (if any) only after going back
+      // to 'Borrowing' since borrows that use a shard don't check
+      // the state of the tally.
+      Unfold();
+
       // At this point a call to 'borrow()' may mean that there are
       // outstanding 'borrowed_ref/ptr' when the watch callback gets
       // invoked and thus it's up to the users of this abstraction to
       // avoid making calls to 'borrow()' until after the watch
       // callback gets invoked if they want to guarantee that there
-      // are no outstanding 'borrowed_ref/ptr'.
+      // are no outstanding 'borrowed_ref/ptr' (or use 'Drain()' with
+      // 'TryBorrow()' instead which rejects any new borrows).
+
+      executor.Run(std::move(f));
+    } else if (state == State::Draining) {
+      // Move out 'watch_' (if we took over a watch, see 'Drain()')
+      // and the drain callback before we finish draining since after
+      // that we might get destructed at any time, see the destructor.
+      Extension& extension = *extension_.load();
+
+      auto watch = std::move(watch_);
+      Executor watch_executor = extension.watch_executor;
+
+      auto drain = std::move(extension.drain);
+      Executor drain_executor = extension.drain_executor;
+
+      tally_.Update(state, State::Drained);
+
+      if (watch) {
+        watch_executor.Run(std::move(watch));
+      }
+
+      drain_executor.Run(std::move(drain));
+    } else if (state == State::Orphaned) {
+      // We were the last borrow of an orphaned borrowable, see
+      // 'Orphan()', so it's up to us to destruct it, but if it was
+      // orphaned while draining we first need to finish draining.
+      Extension* extension = extension_.load();
+      if (extension != nullptr && extension->drain) {
+        if (watch_) {
+          extension->watch_executor.Run(std::move(watch_));
+        }
+
+        extension->drain_executor.Run(std::move(extension->drain));
+      }
 
-      f();
+      Reclaim();
     }
   }
 
@@ -96,33 +595,105 @@ class TypeErasedBorrowable {
   TypeErasedBorrowable()
     : tally_(State::Borrowing) {}
 
+  explicit TypeErasedBorrowable(Atomic)
+    : TypeErasedBorrowable() {}
+
+  explicit TypeErasedBorrowable(Sharded)
+    : tally_(State::Borrowing) {
+    AllocateShards();
+  }
+
+  explicit TypeErasedBorrowable(Biased)
+    : tally_(State::Borrowing) {
+    Bias();
+  }
+
+  explicit TypeErasedBorrowable(SingleThreaded)
+    : tally_(State::Borrowing) {
+    Localize();
+  }
+
+  template <typename Policy>
+  explicit TypeErasedBorrowable(CacheAligned<Policy>)
+    : TypeErasedBorrowable(Policy()) {}
+
   TypeErasedBorrowable(const TypeErasedBorrowable& that)
-    : tally_(State::Borrowing) {}
+    : tally_(State::Borrowing) {
+    AllocateShardsLike(that);
+    InheritDefaultExecutor(that);
+  }
 
   TypeErasedBorrowable(TypeErasedBorrowable&& that)
     : tally_(State::Borrowing) {
+    AllocateShardsLike(that);
+    InheritDefaultExecutor(that);
+
     // We need to wait until all borrows have been relinquished so
     // any memory associated with 'that' can be safely released.
-    that.WaitUntilBorrowsEquals(0);
+    that.Disarm();
+    that.Fold();
+    that.WaitUntilFoldedBorrowsEquals(0);
+    that.WaitForReaders();
+
+    // 'that' can still be borrowed after being moved so start using
+    // its shards again (if any).
+    that.Unfold();
   }
 
   virtual ~TypeErasedBorrowable() {
-    auto state = State::Borrowing;
-    if (!tally_.Update(state, State::Destructing)) {
+    // Fold any shards first so that we won't ever start using them
+    // again and can wait on just the tally.
+    Fold();
+
+    auto state = tally_.Wait([](auto, size_t) { return true; }).first;
+
+    // Wait for draining to finish (see 'Drain()') since the last
+    // relinquish still needs to transition to 'Drained'.
+    if (state == State::Draining) {
+      WaitUntilFoldedBorrowsEquals(0);
+      state = tally_.Wait([](auto state, size_t) {
+        return state != State::Draining;
+      }).first;
+    }
+
+    // NOTE: we might also be getting destructed because we've been
+    // orphaned, see 'Orphan()', in which case the last borrow has
+    // already been relinquished (see 'Reclaim()') and we can't be
+    // borrowed again so there is no need to transition.
+    bool destructing = state == State::Orphaned;
+    while (!destructing
+           && (state == State::Borrowing
+               || state == State::Orphaned
+               || state == State::Drained)) {
+      destructing = tally_.Update(state, State::Destructing);
+    }
+
+    if (!destructing) {
       LOG(FATAL) << "Unable to transition to Destructing from state " << state;
     } else {
       // NOTE: it's possible that we'll block forever if exceptions
       // were thrown and destruction was not successful.
       // if (!std::uncaught_exceptions() > 0) {
-      WaitUntilBorrowsEquals(0);
+      Disarm();
+      WaitUntilFoldedBorrowsEquals(0);
+      WaitForReaders();
       // }
     }
+
+    // NOTE: 'Borrowable' has already expired any 'borrowed_weak'
+    // before destructing 'T' but 'enable_borrowable_from_this' can't.
+    Expire();
+
+    delete extension_.load();
   }
 
   enum class State : uint8_t {
     Borrowing,
     Watching,
     Destructing,
+    Orphaned,
+    Draining,
+    Drained,
   };
 
   // We need to overload '<<' operator for 'State' enum class in
@@ -137,147 +708,1607 @@ class TypeErasedBorrowable {
         return os << "Watching";
       case TypeErasedBorrowable::State::Destructing:
         return os << "Destructing";
+      case TypeErasedBorrowable::State::Orphaned:
+        return os << "Orphaned";
+      case TypeErasedBorrowable::State::Draining:
+        return os << "Draining";
+      case TypeErasedBorrowable::State::Drained:
+        return os << "Drained";
       default:
         LOG(FATAL) << "Unreachable";
     }
   };
 
-  // NOTE: 'stateful_tally' ensures this is non-moveable (but still
-  // copyable). What would it mean to be able to borrow a pointer to
-  // something that might move!? If an implemenetation ever replaces
-  // 'stateful_tally' with something else care will need to be taken
-  // to ensure that 'Borrowable' doesn't become moveable.
-  StatefulTally<State> tally_;
+  // Helper that increments the borrows if the tally is currently in
+  // 'state', otherwise returns false and updates 'state' to be the
+  // current state of the tally.
+  bool Increment(State& state) {
+    if ((shards_ != nullptr && state == State::Borrowing && UpdateShard(1))
+        || tally_.Increment(state)) {
+      Borrowed(1);
+      return true;
+    }
 
-  std::function<void()> watch_;
+    return false;
+  }
 
- private:
-  // Only 'borrowed_ref/ptr' can reborrow!
-  template <typename>
-  friend class borrowed_ref;
+  // Like 'Increment()' except increments by 'borrows' with a single
+  // atomic operation.
+  bool Increment(State& state, size_t borrows) {
+    if (shards_ != nullptr
+        && state == State::Borrowing
+        && UpdateShard(static_cast<int64_t>(borrows))) {
+      Borrowed(borrows);
+      return true;
+    }
 
-  template <typename>
-  friend class borrowed_ptr;
+    auto [current, count] = tally_.Wait([](auto, size_t) { return true; });
 
-  template <typename>
-  friend class borrowed_callable;
+    size_t retries = 0;
 
-  void Reborrow() {
-    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+    do {
+      if (current != state) {
+        state = current;
+        Retried(retries);
+        return false;
+      }
+    } while (!tally_.Update(current, count, current, count + borrows)
+             && ++retries);
 
-    CHECK_GT(count, 0u);
+    Retried(retries);
+    Borrowed(borrows);
 
-    do {
-      CHECK_NE(state, State::Destructing);
-    } while (!tally_.Increment(state));
+    return true;
   }
-};
 
-////////////////////////////////////////////////////////////////////////
+  // Like 'Increment()' followed by 'Orphan()' but with a single
+  // atomic operation, which is only possible when nothing else could
+  // have borrowed yet, e.g., right after constructing, and without
+  // any shards or limit, see 'BorrowablePool'.
+  void IncrementAndOrphan() {
+    CHECK(shards_ == nullptr && !limited_)
+        << "Only atomic (and unlimited) borrowables can be orphaned "
+        << "while borrowing";
 
-template <typename T>
-class Borrowable : public TypeErasedBorrowable {
- public:
-  template <
-      typename... Args,
-      std::enable_if_t<std::is_constructible_v<T, Args...>, int> = 0>
-  Borrowable(Args&&... args)
-    : TypeErasedBorrowable(),
-      t_(std::forward<Args>(args)...) {}
+    auto state = State::Borrowing;
+    size_t count = 0;
+    if (!tally_.Update(state, count, State::Orphaned, 1)) {
+      LOG(FATAL) << "Unable to borrow and orphan in state " << state
+                 << " with " << count << " borrows";
+    }
 
-  Borrowable(const Borrowable& that)
-    : TypeErasedBorrowable(that),
-      t_(that.t_) {}
+    Borrowed(1);
+  }
 
-  Borrowable(Borrowable&& that)
-    : TypeErasedBorrowable(std::move(that)),
-      t_(std::move(that.t_)) {}
+  // Shared and exclusive borrows, see 'Borrowable::BorrowShared()'
+  // and 'Borrowable::BorrowExclusive()', only use the tally, where an
+  // exclusive borrow counts as 'kExclusive' borrows so that counting
+  // a borrow and checking whether or not it's allowed is the same
+  // atomic operation.
+  static constexpr size_t kExclusive = size_t(1) << 40;
 
-  borrowed_ref<T> Borrow() {
-    auto state = State::Borrowing;
-    if (tally_.Increment(state)) {
-      return borrowed_ref<T>(*this, t_);
-    } else {
-      // Why are you borrowing when you shouldn't be?
-      LOG(FATAL) << "Attempting to borrow in state " << state;
-    }
+  bool IncrementShared(State& state, bool wait) {
+    return IncrementIf(state, 1, wait, [](size_t count) {
+      return count < kExclusive;
+    });
   }
 
-  template <typename F>
-  borrowed_callable<F> Borrow(F&& f) {
-    auto state = State::Borrowing;
-    if (tally_.Increment(state)) {
-      return borrowed_callable<F>(std::forward<F>(f), this);
-    } else {
-      // Why are you borrowing when you shouldn't be?
-      LOG(FATAL) << "Attempting to borrow in state " << state;
+  bool IncrementExclusive(State& state, bool wait) {
+    // Our own deferred borrows would otherwise keep us waiting.
+    DeferRelinquish::Flush(this);
+
+    bool incremented = IncrementIf(state, kExclusive, wait, [](size_t count) {
+      return count == 0;
+    });
+
+    if (!incremented) {
+      return false;
     }
-  }
 
-  T* get() {
-    return &t_;
-  }
+    // Read borrows aren't in the tally so they can't be excluded,
+    // instead once read borrowed we wait for any read borrows that
+    // started before we incremented (any later ones are an error).
+    //
+    // NOTE: checking this after incrementing (and 'ReadBorrow()'
+    // setting it before checking the tally) ensures that at least one
+    // of us notices the other.
+    if (read_borrowed_.load()) {
+      if (wait) {
+        GracePeriod::Wait();
+      } else {
+        // Waiting for a grace period might block, so back out.
+        Relinquish(kExclusive);
+        Unpark(this);
+        return false;
+      }
+    }
 
-  const T* get() const {
-    return &t_;
+    return true;
   }
 
-  T* operator->() {
-    return get();
+  // Relinquishes an exclusive borrow, see 'IncrementExclusive()'.
+  void RelinquishExclusive(const BorrowDiagnostics& diagnostics) {
+    Untrack(diagnostics);
+    Relinquish(kExclusive);
+
+    // 'Relinquish()' only unparks when the tally gets back to 0 but
+    // there might be shared borrows waiting even if it didn't, e.g.,
+    // because of an outstanding 'Borrow()'.
+    //
+    // NOTE: 'Unpark()' never accesses 'this' which might have been
+    // destructed by now.
+    Unpark(this);
   }
 
-  const T* operator->() const {
-    return get();
-  }
+  // Increments the borrows by 'borrows' if the tally is currently in
+  // 'state' and 'allowed(count)', waiting until it is allowed if
+  // 'wait' is true, otherwise returns false and updates 'state' to be
+  // the current state of the tally (which is unchanged if 'wait' is
+  // false and we would have had to wait).
+  template <typename F>
+  bool IncrementIf(State& state, size_t borrows, bool wait, F&& allowed) {
+    CHECK(shards_ == nullptr && !limited_)
+        << "Shared and exclusive borrows are only supported by 'Atomic' "
+        << "borrowables without a limit";
 
-  T& operator*() {
-    return t_;
-  }
+    auto [current, count] = tally_.Wait([](auto, size_t) { return true; });
 
-  const T& operator*() const {
-    return t_;
-  }
+    size_t retries = 0;
 
- private:
-  T t_;
-};
+    while (true) {
+      if (current != state) {
+        state = current;
+        Retried(retries);
+        return false;
+      } else if (allowed(count)) {
+        if (tally_.Update(current, count, current, count + borrows)) {
+          break;
+        }
+        retries++;
+      } else if (!wait) {
+        Retried(retries);
+        return false;
+      } else {
+        size_t spins = 0;
 
-////////////////////////////////////////////////////////////////////////
+        std::tie(current, count) = tally_.Wait([&](auto s, size_t c) {
+          return s != state || allowed(c) || ++spins > kSpins;
+        });
 
-template <typename T>
-class enable_borrowable_from_this : public TypeErasedBorrowable {
- public:
-  borrowed_ref<T> Borrow() {
-    static_assert(
-        std::is_base_of_v<enable_borrowable_from_this<T>, T>,
-        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+        if (current == state && !allowed(count)) {
+          Park([&]() {
+            return tally_.state() != state || allowed(tally_.count());
+          });
 
-    auto state = State::Borrowing;
-    if (tally_.Increment(state)) {
-      return borrowed_ref<T>(*this, *static_cast<T*>(this));
-    } else {
-      // Why are you borrowing when you shouldn't be?
-      LOG(FATAL) << "Attempting to borrow in state " << state;
+          std::tie(current, count) =
+              tally_.Wait([](auto, size_t) { return true; });
+        }
+      }
     }
-  }
 
-  template <typename F>
-  borrowed_callable<F> Borrow(F&& f) {
-    static_assert(
-        std::is_base_of_v<enable_borrowable_from_this<T>, T>,
-        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+    Retried(retries);
+    Borrowed(1);
 
-    auto state = State::Borrowing;
-    if (tally_.Increment(state)) {
-      return borrowed_callable<F>(std::forward<F>(f), this);
-    } else {
-      // Why are you borrowing when you shouldn't be?
-      LOG(FATAL) << "Attempting to borrow in state " << state;
-    }
+    return true;
   }
-};
 
-////////////////////////////////////////////////////////////////////////
+  // Like 'Increment()' except doesn't increment if there are already
+  // as many borrows as the limit in which case returns false without
+  // updating 'state', see 'LimitBorrows()'.
+  bool TryIncrement(State& state) {
+    if (!limited_) {
+      return Increment(state);
+    }
+
+    const auto& limit = extension_.load()->limit;
+
+    size_t retries = 0;
+
+    while (true) {
+      auto [current, count, below] = LimitedTally();
+
+      if (current != state) {
+        state = current;
+        Retried(retries);
+        return false;
+      }
+
+      // NOTE: 'count' includes the borrow held while armed.
+      size_t borrows = below != 0 ? count - 1 : count;
+
+      if (borrows >= limit.load(std::memory_order_relaxed)) {
+        Retried(retries);
+        return false;
+      }
+
+      if (tally_.Update(current, count, current, count + 1)) {
+        break;
+      }
+
+      retries++;
+    }
+
+    Retried(retries);
+    Borrowed(1);
+
+    return true;
+  }
+
+  // Helpers for recording statistics which are no-ops unless
+  // compiled with 'STOUT_BORROWABLE_STATS', see 'BorrowableStats'.
+  template <typename T>
+  void Describe() {
+#ifdef STOUT_BORROWABLE_STATS
+    stats_.type(typeid(T).name());
+#endif
+  }
+
+  void Borrowed([[maybe_unused]] size_t borrows) {
+#ifdef STOUT_BORROWABLE_STATS
+    stats_.Borrowed(borrows, this->borrows());
+#endif
+  }
+
+  void Retried([[maybe_unused]] size_t retries) {
+#ifdef STOUT_BORROWABLE_STATS
+    stats_.Retried(retries);
+#endif
+  }
+
+  // Returns the diagnostics of a new borrow made at 'location' which
+  // only gets tracked when compiled with 'STOUT_BORROWABLE_TRACKING',
+  // see 'BorrowTracking'.
+  BorrowDiagnostics Diagnose([[maybe_unused]] const SourceLocation& location) {
+    BorrowDiagnostics diagnostics;
+#ifdef STOUT_BORROWABLE_TRACKING
+    diagnostics.record = BorrowTracking::Track(this, location);
+#endif
+    return diagnostics;
+  }
+
+  // Shared by a borrowable and every 'borrowed_weak' of it so that a
+  // 'borrowed_weak' never has to touch a borrowable that might have
+  // been destructed, see 'Expire()'. Allocated the first time a
+  // 'borrowed_weak' gets made.
+  struct WeakControl {
+    // Set in 'pins' once the borrowable has been expired.
+    static constexpr size_t kExpired =
+        size_t(1) << (std::numeric_limits<size_t>::digits - 1);
+
+    explicit WeakControl(TypeErasedBorrowable* borrowable)
+      : borrowable(borrowable) {}
+
+    // Returns the borrowable, which can't finish expiring until
+    // 'Unpin()' gets called, or nullptr if it has already expired.
+    TypeErasedBorrowable* Pin() {
+      if ((pins.fetch_add(1) & kExpired) != 0) {
+        pins.fetch_sub(1);
+        return nullptr;
+      }
+      return borrowable;
+    }
+
+    void Unpin() {
+      pins.fetch_sub(1);
+    }
+
+    bool expired() const {
+      return (pins.load() & kExpired) != 0;
+    }
+
+    void Reference() {
+      references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Unreference() {
+      if (references.fetch_sub(1) == 1) {
+        delete this;
+      }
+    }
+
+    TypeErasedBorrowable* const borrowable;
+
+    std::atomic<size_t> pins = 0;
+
+    // One for the borrowable (until it expires) plus one for each
+    // 'borrowed_weak'.
+    std::atomic<size_t> references = 1;
+  };
+
+  // Returns the control block (with a reference for the caller) for
+  // a new 'borrowed_weak', allocating it if necessary.
+  WeakControl* Weaken() {
+    WeakControl* weak = weak_.load();
+    if (weak == nullptr) {
+      auto* allocated = new WeakControl(this);
+      if (weak_.compare_exchange_strong(weak, allocated)) {
+        weak = allocated;
+      } else {
+        delete allocated;
+      }
+    }
+
+    weak->Reference();
+
+    return weak;
+  }
+
+  // Makes every 'borrowed_weak' fail to borrow from now on and waits
+  // for any that are in the middle of trying to borrow, after which
+  // they'll never touch this borrowable again.
+  //
+  // NOTE: a borrow that was made before expiring is an outstanding
+  // borrow like any other.
+  void Expire() {
+    WeakControl* weak = weak_.exchange(nullptr);
+    if (weak == nullptr) {
+      return;
+    }
+
+    size_t pins = weak->pins.fetch_or(WeakControl::kExpired);
+
+    // Pins are only ever held while incrementing the tally so this
+    // never waits for long.
+    while ((pins & ~WeakControl::kExpired) != 0) {
+      std::this_thread::yield();
+      pins = weak->pins.load();
+    }
+
+    weak->Unreference();
+  }
+
+  // NOTE: 'stateful_tally' ensures this is non-moveable (but still
+  // copyable). What would it mean to be able to borrow a pointer to
+  // something that might move!? If an implemenetation ever replaces
+  // 'stateful_tally' with something else care will need to be taken
+  // to ensure that 'Borrowable' doesn't become moveable.
+  StatefulTally<State> tally_;
+
+  // Watch callbacks are stored inline so arming a watch never
+  // allocates, see 'STOUT_BORROWABLE_WATCH_CAPACITY'.
+  static constexpr size_t kWatchCapacity = std::max(
+      size_t(STOUT_BORROWABLE_WATCH_CAPACITY),
+      sizeof(std::function<void()>));
+
+  InlineCallback<kWatchCapacity> watch_;
+
+  // Type-erased reference to an executor that watch (and drain)
+  // callbacks get submitted to, see 'Watch(executor, f)', or if there
+  // isn't one then callbacks get invoked by the relinquishing thread.
+  struct Executor {
+    template <typename E>
+    static Executor For(E& executor) {
+      return Executor{
+          &executor,
+          [](void* executor, InlineCallback<kWatchCapacity>&& f) {
+            static_cast<E*>(executor)->Submit(std::move(f));
+          }};
+    }
+
+    void Run(InlineCallback<kWatchCapacity>&& f) const {
+      if (submit != nullptr) {
+        submit(executor, std::move(f));
+      } else {
+        f();
+      }
+    }
+
+    void* executor = nullptr;
+    void (*submit)(void*, InlineCallback<kWatchCapacity>&&) = nullptr;
+  };
+
+  // State that most borrowables never need, which gets allocated
+  // the first time it's needed (see 'Extend()') rather than taking up
+  // space in every borrowable.
+  struct Extension {
+    // See 'LimitBorrows()' and 'WatchBorrowsBelow()'.
+    std::atomic<size_t> limit = std::numeric_limits<size_t>::max();
+    std::atomic<size_t> below = 0;
+    InlineCallback<kWatchCapacity> below_watch;
+
+    // Executor for the currently armed 'watch_' (if any).
+    Executor watch_executor;
+
+    // Callback (and executor) for when draining finishes, which is
+    // separate from 'watch_' so that draining can take over a watch.
+    InlineCallback<kWatchCapacity> drain;
+    Executor drain_executor;
+
+    // Executor for 'Watch(f)' and 'Drain(f)', see
+    // 'SetDefaultExecutor()'.
+    Executor default_executor;
+  };
+
+  // Returns the extension, allocating it if necessary.
+  Extension& Extend() {
+    Extension* extension = extension_.load();
+    if (extension == nullptr) {
+      auto* allocated = new Extension();
+      if (extension_.compare_exchange_strong(extension, allocated)) {
+        extension = allocated;
+      } else {
+        delete allocated;
+      }
+    }
+    return *extension;
+  }
+
+  Executor DefaultExecutor() const {
+    Extension* extension = extension_.load();
+    return extension != nullptr ? extension->default_executor : Executor();
+  }
+
+  Executor WatchExecutor() const {
+    Extension* extension = extension_.load();
+    return extension != nullptr ? extension->watch_executor : Executor();
+  }
+
+  void InheritDefaultExecutor(const TypeErasedBorrowable& that) {
+    Executor executor = that.DefaultExecutor();
+    if (executor.submit != nullptr) {
+      Extend().default_executor = executor;
+    }
+  }
+
+  // Arms (or, if there aren't any borrows, immediately runs) 'f' on
+  // 'executor', see 'Watch()'.
+  template <typename F>
+  bool WatchOn(const Executor& executor, F&& f) {
+    DeferRelinquish::Flush(this);
+
+    Fold();
+
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    size_t retries = 0;
+
+    do {
+      if (state != State::Borrowing) {
+        return false;
+      } else if (count == 0 && !read_borrowed_.load()) {
+        Unfold();
+        executor.Run(std::forward<F>(f));
+        return true;
+      }
+    } while (!tally_.Update(state, count, State::Watching, count + 1)
+             && ++retries);
+
+    Retried(retries);
+
+    // Anyone that unfolded after we folded above but before we
+    // started watching might have started using the shards again, in
+    // which case we fold them (again) now that no one else will, see
+    // 'Unfold()'.
+    Fold();
+
+    // Wait for any outstanding 'borrowed_read_ref' (which aren't in
+    // the tally) now that no more can be borrowed.
+    WaitForReaders();
+
+    watch_ = std::forward<F>(f);
+
+    // Only allocate the extension for an executor that isn't the
+    // default of invoking 'f' on the relinquishing thread.
+    if (executor.submit != nullptr || extension_.load() != nullptr) {
+      Extend().watch_executor = executor;
+    }
+
+    Relinquish();
+
+    return true;
+  }
+
+  // Starts draining with 'f' to be run on 'executor', see 'Drain()'.
+  template <typename F>
+  bool DrainOn(const Executor& executor, F&& f) {
+    DeferRelinquish::Flush(this);
+
+    Fold();
+
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    size_t retries = 0;
+
+    do {
+      if (state == State::Watching && count == 0) {
+        // The watch callback is being invoked so wait until we're
+        // back to 'Borrowing' rather than take over the watch.
+        std::tie(state, count) = tally_.Wait([](auto state, size_t count) {
+          return state != State::Watching || count != 0;
+        });
+      }
+
+      if (state != State::Borrowing && state != State::Watching) {
+        return false;
+      }
+    } while (!tally_.Update(state, count, State::Draining, count + 1)
+             && ++retries);
+
+    Retried(retries);
+
+    // See the comment in 'WatchOn()'.
+    Fold();
+
+    // No one can borrow any more so there's no need to keep watching
+    // for borrows below a threshold.
+    Disarm();
+
+    WaitForReaders();
+
+    // NOTE: if we took over a watch then 'watch_' is still armed
+    // and gets invoked right before the drain callback, see
+    // 'Relinquish()'.
+    Extension& extension = Extend();
+    extension.drain = std::forward<F>(f);
+    extension.drain_executor = executor;
+
+    Relinquish();
+
+    return true;
+  }
+
+ private:
+  // Only 'borrowed_ref/ptr' can reborrow!
+  template <typename>
+  friend class borrowed_ref;
+
+  template <typename>
+  friend class borrowed_ptr;
+
+  template <typename>
+  friend class borrowed_callable;
+
+  template <typename>
+  friend class borrowed_batch;
+
+  // Only 'borrowed_read_ref' can read borrow!
+  template <typename>
+  friend class borrowed_read_ref;
+
+  template <typename, typename>
+  friend class borrowed_compact_ptr;
+
+  template <typename>
+  friend class borrowed_span;
+
+  template <typename>
+  friend class borrowed_lease;
+
+  template <typename>
+  friend class borrowed_weak;
+
+  template <typename>
+  friend class borrowed_exclusive_ptr;
+
+  // Only 'borrowable_owner' (and 'BorrowableMap') can orphan!
+  template <typename, typename>
+  friend class borrowable_owner;
+
+  template <typename, typename, typename, typename>
+  friend class BorrowableMap;
+
+  void Reborrow() {
+    if (shards_ != nullptr && UpdateShard(1)) {
+      Borrowed(1);
+      return;
+    }
+
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    CHECK_GT(count, 0u);
+
+    size_t retries = 0;
+
+    do {
+      CHECK_NE(state, State::Destructing);
+    } while (!tally_.Increment(state) && ++retries);
+
+    Retried(retries);
+    Borrowed(1);
+  }
+
+  // Stops tracking (and accounts for) a borrow without relinquishing
+  // it, e.g., when a 'borrowed_lease' takes back a borrow, see
+  // 'BorrowDiagnostics'.
+  void Untrack([[maybe_unused]] const BorrowDiagnostics& diagnostics) {
+#ifdef STOUT_BORROWABLE_TRACKING
+    BorrowTracking::Untrack(diagnostics.record);
+#endif
+#ifdef STOUT_BORROWABLE_STATS
+    stats_.Relinquished(diagnostics.borrowed);
+#endif
+  }
+
+  // Like 'Reborrow()' except reborrows 'borrows' times with a single
+  // atomic operation, e.g., when splitting a 'borrowed_span'.
+  void Reborrow(size_t borrows) {
+    if (borrows == 0) {
+      return;
+    }
+
+    if (shards_ != nullptr
+        && UpdateShard(static_cast<int64_t>(borrows))) {
+      Borrowed(borrows);
+      return;
+    }
+
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    CHECK_GT(count, 0u);
+
+    size_t retries = 0;
+
+    do {
+      CHECK_NE(state, State::Destructing);
+    } while (!tally_.Update(state, count, state, count + borrows)
+             && ++retries);
+
+    Retried(retries);
+    Borrowed(borrows);
+  }
+
+  // Each shard gets its own cache line so that threads using
+  // different shards never contend with one another. A shard's count
+  // may be negative since a borrow might be relinquished on a
+  // different thread than it was borrowed on, but the sum of all the
+  // shards and the tally never is.
+  struct alignas(64) Shard {
+    std::atomic<int64_t> count = 0;
+  };
+
+  // Sentinel stored into each shard when folding. Any shard update
+  // that sees a count at or below 'kFolded / 2' knows that it didn't
+  // get counted and must use the tally instead (it doesn't matter if
+  // it perturbs the sentinel since unfolding stores 0).
+  static constexpr int64_t kFolded = std::numeric_limits<int64_t>::min() / 2;
+
+  enum class Sharding : uint8_t {
+    Sharded,
+    Folding,
+    Folded,
+  };
+
+  void AllocateShards() {
+    size_t shards = 1;
+    while (shards < std::thread::hardware_concurrency()) {
+      shards *= 2;
+    }
+
+    shards_ = std::make_unique<Shard[]>(shards);
+    shards_mask_ = shards - 1;
+  }
+
+  // A biased borrowable has two shards, one for the owning thread
+  // and one shared by all other threads.
+  static constexpr size_t kOwnerShard = 0;
+  static constexpr size_t kSharedShard = 1;
+
+  void Bias() {
+    shards_ = std::make_unique<Shard[]>(2);
+    shards_mask_ = 1;
+    biased_ = true;
+    owner_ = std::this_thread::get_id();
+  }
+
+  // A single threaded borrowable only has the owning thread's shard.
+  void Localize() {
+    shards_ = std::make_unique<Shard[]>(1);
+    shards_mask_ = 0;
+    single_threaded_ = true;
+    owner_ = std::this_thread::get_id();
+  }
+
+  // Uses the same policy as 'that' when copying or moving.
+  void AllocateShardsLike(const TypeErasedBorrowable& that) {
+    if (that.single_threaded_) {
+      Localize();
+    } else if (that.biased_) {
+      Bias();
+    } else if (that.shards_ != nullptr) {
+      AllocateShards();
+    }
+  }
+
+  static size_t ShardIndex() {
+    static std::atomic<size_t> threads = 0;
+    static thread_local size_t index = threads.fetch_add(1);
+    return index;
+  }
+
+  // Adds 'delta' to the calling thread's shard, returns false if the
+  // shards have been folded in which case the caller must use the
+  // tally instead.
+  bool UpdateShard(int64_t delta) {
+    if (single_threaded_) {
+      DCHECK_EQ(std::this_thread::get_id(), owner_)
+          << "Single threaded borrowables must only be used "
+          << "on the thread that constructed them";
+      return UpdateOwnerShard(delta);
+    } else if (biased_) {
+      if (std::this_thread::get_id() == owner_) {
+        return UpdateOwnerShard(delta);
+      } else {
+        return UpdateShard(shards_[kSharedShard], delta);
+      }
+    }
+
+    return UpdateShard(shards_[ShardIndex() & shards_mask_], delta);
+  }
+
+  bool UpdateOwnerShard(int64_t delta) {
+    // Only the owning thread updates its shard (and it's the only
+    // thread that folds) so there is no need for an atomic
+    // read-modify-write, it just needs to make sure the shards
+    // haven't been folded (they can only get unfolded by other
+    // threads, see 'Relinquish()').
+    if (sharding_.load(std::memory_order_acquire) == Sharding::Sharded) {
+      auto& count = shards_[kOwnerShard].count;
+      count.store(
+          count.load(std::memory_order_relaxed) + delta,
+          std::memory_order_relaxed);
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  bool UpdateShard(Shard& shard, int64_t delta) {
+    while (true) {
+      if (shard.count.fetch_add(delta) > kFolded / 2) {
+        return true;
+      }
+
+      // We must not touch the tally until the fold has finished,
+      // otherwise we might relinquish a borrow that is still
+      // accounted for in a shard and underflow the tally.
+      AtomicBackoff backoff;
+      Sharding sharding = Sharding::Folding;
+      while ((sharding = sharding_.load()) == Sharding::Folding) {
+        backoff.pause();
+      }
+
+      if (sharding == Sharding::Folded) {
+        return false;
+      }
+
+      // Shards were unfolded after we tried, try again.
+    }
+  }
+
+  // Moves all of the shards (if any) into the tally. Once this
+  // returns all borrows and relinquishes go through the tally until
+  // 'Unfold()' gets called.
+  void Fold() {
+    if (shards_ == nullptr) {
+      return;
+    }
+
+    auto sharding = Sharding::Sharded;
+    while (!sharding_.compare_exchange_strong(sharding, Sharding::Folding)) {
+      // Someone else is folding (or has already folded) or unfolding,
+      // wait until they've finished.
+      AtomicBackoff backoff;
+      while ((sharding = sharding_.load()) == Sharding::Folding) {
+        backoff.pause();
+      }
+
+      if (sharding == Sharding::Folded) {
+        return;
+      }
+
+      // Unfolded while we were waiting, try again.
+    }
+
+    if (biased_ || single_threaded_) {
+      CHECK_EQ(std::this_thread::get_id(), owner_)
+          << (biased_ ? "Biased" : "Single threaded")
+          << " borrowables must be watched, moved, and destructed "
+          << "on the thread that constructed them";
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i <= shards_mask_; i++) {
+      sum += shards_[i].count.exchange(kFolded);
+    }
+
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    do {
+      CHECK_GE(static_cast<int64_t>(count) + sum, 0);
+    } while (!tally_.Update(state, count, state, count + sum));
+
+    sharding_.store(Sharding::Folded);
+  }
+
+  // Waits until the tally equals 'borrows' which requires any shards
+  // to already have been folded, see 'Fold()'.
+  void WaitUntilFoldedBorrowsEquals(size_t borrows) {
+    DeferRelinquish::Flush(this);
+
+    if (single_threaded_) {
+      CHECK_EQ(tally_.count(), borrows)
+          << "Waiting for borrows of a single threaded borrowable "
+          << "would wait forever";
+      return;
+    }
+
+#ifdef STOUT_BORROWABLE_STATS
+    auto since = stats_.Waiting();
+#endif
+
+    size_t spins = 0;
+
+    auto [state, count] = tally_.Wait([&](auto /* state */, size_t count) {
+      return count == borrows || (borrows == 0 && ++spins > kSpins);
+    });
+
+    if (count != borrows) {
+      Park();
+    }
+
+#ifdef STOUT_BORROWABLE_STATS
+    stats_.Waited(since);
+#endif
+  }
+
+  // Starts using the shards again (if any) if still 'Borrowing'.
+  // Borrows that were counted in the tally while folded stay there and
+  // are just as correct.
+  //
+  // NOTE: we go through 'Folding' while unfolding so that a
+  // concurrent 'Fold()' waits for us (and then folds again) and we
+  // check the state only after that so that either we see that a
+  // watch (or drain) has been armed and stay folded or it folds again
+  // after arming, see 'WatchOn()'.
+  void Unfold() {
+    if (shards_ == nullptr) {
+      return;
+    }
+
+    auto sharding = Sharding::Folded;
+    if (!sharding_.compare_exchange_strong(sharding, Sharding::Folding)) {
+      // Not folded or someone else is unfolding.
+      return;
+    }
+
+    if (tally_.state() != State::Borrowing) {
+      sharding_.store(Sharding::Folded);
+      return;
+    }
+
+    for (size_t i = 0; i <= shards_mask_; i++) {
+      shards_[i].count.store(0);
+    }
+
+    sharding_.store(Sharding::Sharded);
+  }
+
+  // Read borrows aren't counted in the tally, instead they enter a
+  // read-side critical section (which only writes thread-local state)
+  // and then check that it's still valid to borrow, and we wait for
+  // a grace period after it's no longer valid to borrow (i.e., when
+  // watching or destructing), see 'GracePeriod'.
+  void ReadBorrow() {
+    // Remember that we've been read borrowed so that only
+    // borrowables that have been read borrowed wait for a grace
+    // period. Checking first avoids writing to a shared cache line
+    // after the first read borrow.
+    if (!read_borrowed_.load(std::memory_order_relaxed)) {
+      read_borrowed_.store(true);
+    }
+
+    GracePeriod::Enter();
+
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    if (state != State::Borrowing) {
+      GracePeriod::Exit();
+
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to read borrow in state " << state;
+    } else if (count >= kExclusive) {
+      GracePeriod::Exit();
+
+      LOG(FATAL) << "Attempting to read borrow while exclusively borrowed";
+    }
+  }
+
+  void WaitForReaders() {
+    if (read_borrowed_.load()) {
+      GracePeriod::Wait();
+    }
+  }
+
+  // Gives up ownership without waiting for all borrows to be
+  // relinquished by transitioning to 'Orphaned' so that the last
+  // relinquish destructs (and deallocates) this borrowable instead,
+  // or destructs immediately if there aren't any borrows, see
+  // 'Reclaim()'.
+  //
+  // If draining (see 'Drain()') then the last relinquish still
+  // invokes the drain callback before destructing, and if already
+  // drained then we destruct immediately.
+  void Orphan() {
+    // Fold any shards as we'll need to know when the last borrow
+    // gets relinquished.
+    Fold();
+
+    Disarm();
+
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    do {
+      if (state == State::Draining && count == 0) {
+        // The last borrow has already been relinquished so wait for
+        // it to finish draining, see 'Relinquish()'.
+        std::tie(state, count) = tally_.Wait([](auto state, size_t) {
+          return state != State::Draining;
+        });
+      }
+
+      if (state != State::Borrowing
+          && state != State::Draining
+          && state != State::Drained) {
+        LOG(FATAL) << "Unable to transition to Orphaned from state " << state;
+      }
+    } while (!tally_.Update(state, count, State::Orphaned, count));
+
+    if (count == 0) {
+      Reclaim();
+    }
+  }
+
+  // Destructs (and deallocates) an orphaned borrowable once it no
+  // longer has any borrows, see 'Orphan()'. By default borrowables
+  // must have been allocated with 'new' but, e.g., borrowables from
+  // a 'BorrowablePool' get recycled instead.
+  //
+  // NOTE: nothing in 'this' may be accessed after this returns.
+  virtual void Reclaim() {
+    delete this;
+  }
+
+  // Like 'StatefulTally::Decrement()' except decrements by 'borrows'
+  // with a single atomic operation.
+  std::pair<State, size_t> Decrement(size_t borrows) {
+    auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+
+    do {
+      CHECK_GE(count, borrows);
+    } while (!tally_.Update(state, count, state, count - borrows));
+
+    return {state, count - borrows};
+  }
+
+  // Used instead of 'StatefulTally::Decrement()' (and 'Decrement()')
+  // by limited borrowables so that the decision whether or not to
+  // invoke the callback from 'WatchBorrowsBelow()' is made with the
+  // exact number of borrows (i.e., it only counts if updating the
+  // tally succeeds) and while we still hold our borrows.
+  std::pair<State, size_t> DecrementLimited(size_t borrows) {
+    Extension& extension = *extension_.load();
+
+    while (true) {
+      auto [state, count, below] = LimitedTally();
+
+      // NOTE: 'count' includes the borrow held while armed.
+      if (below != 0 && count - borrows - 1 < below) {
+        // NOTE: we go back to 'kArming' rather than 0 until we've
+        // moved out the callback so that it can't be armed again (and
+        // the callback overwritten) while we're moving it out.
+        if (extension.below.compare_exchange_strong(below, kArming)) {
+          // Relinquish the borrow held while armed, which can't be
+          // the last borrow since we still hold ours.
+          tally_.Decrement();
+
+          auto f = std::move(extension.below_watch);
+
+          extension.below.store(0);
+
+          f();
+        }
+        continue;
+      }
+
+      CHECK_GE(count, borrows);
+
+      if (tally_.Update(state, count, state, count - borrows)) {
+        return {state, count - borrows};
+      }
+    }
+  }
+
+  // Returns the state and count of the tally along with the threshold
+  // armed by 'WatchBorrowsBelow()' (or 0 if not armed) where the
+  // count includes the borrow held while armed (if armed). Any
+  // subsequent change to the borrows (including arming or disarming)
+  // will fail an update of the tally with the returned count.
+  std::tuple<State, size_t, size_t> LimitedTally() {
+    while (true) {
+      size_t below = Threshold();
+      auto [state, count] = tally_.Wait([](auto, size_t) { return true; });
+      if (extension_.load()->below.load() == below) {
+        return {state, count, below};
+      }
+    }
+  }
+
+  // Returns the threshold armed by 'WatchBorrowsBelow()' or 0 if not
+  // armed, waiting for any concurrent arming to finish.
+  size_t Threshold() {
+    const auto& threshold = extension_.load()->below;
+    size_t below = threshold.load();
+    if (below == kArming) {
+      AtomicBackoff backoff;
+      while ((below = threshold.load()) == kArming) {
+        backoff.pause();
+      }
+    }
+    return below;
+  }
+
+  // Disarms 'WatchBorrowsBelow()' (if armed) without invoking its
+  // callback and relinquishes the borrow held while armed.
+  void Disarm() {
+    if (!limited_) {
+      return;
+    }
+
+    Extension& extension = *extension_.load();
+
+    // NOTE: just like in 'DecrementLimited()' we go back to
+    // 'kArming' until we've reset the callback.
+    size_t below = Threshold();
+    while (below != 0
+           && !extension.below.compare_exchange_weak(below, kArming)) {
+      if (below == kArming) {
+        below = Threshold();
+      }
+    }
+
+    if (below != 0) {
+      extension.below_watch.reset();
+      extension.below.store(0);
+      Relinquish();
+    }
+  }
+
+  // Number of times we'll evaluate the tally (with an atomic backoff
+  // in between each time) before parking.
+  static constexpr size_t kSpins = 64;
+
+  // Threads waiting for borrows to be relinquished get parked in one
+  // of a fixed number of global "parking spots" chosen by the address
+  // of the borrowable so that each borrowable doesn't need its own
+  // mutex and condition variable (and so 'Unpark()' is safe to call
+  // even after the borrowable has been destructed).
+  struct alignas(64) ParkingSpot {
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::atomic<size_t> parked = 0;
+  };
+
+  static ParkingSpot& ParkingSpotFor(const TypeErasedBorrowable* borrowable) {
+    static constexpr size_t kParkingSpots = 64;
+    static ParkingSpot spots[kParkingSpots];
+    auto address = reinterpret_cast<uintptr_t>(borrowable);
+    return spots[(address / alignof(std::max_align_t)) % kParkingSpots];
+  }
+
+  void Park() {
+    Park([this]() {
+      return tally_.count() == 0;
+    });
+  }
+
+  // Parks until 'relinquished' returns true, which must become true
+  // when the tally gets back to 0 (which is when 'Unpark()' gets
+  // called) but may become true sooner, see 'IncrementIf()'.
+  template <typename F>
+  void Park(F&& relinquished) {
+    auto& spot = ParkingSpotFor(this);
+
+    std::unique_lock<std::mutex> lock(spot.mutex);
+
+    // NOTE: incrementing 'parked' before checking the tally (and
+    // 'Unpark()' checking 'parked' after decrementing the tally)
+    // ensures that we can't miss being notified.
+    spot.parked.fetch_add(1);
+
+#ifdef STOUT_BORROWABLE_STATS
+    stats_.Parked();
+#endif
+
+#ifdef STOUT_BORROWABLE_TRACKING
+    // Report who is still borrowing if it's taking too long, e.g., so
+    // that a stalled destructor can be diagnosed.
+    if (!spot.condition.wait_for(
+            lock,
+            BorrowTracking::deadline(),
+            relinquished)) {
+      lock.unlock();
+      std::ostringstream os;
+      size_t tracked = BorrowTracking::Dump(this, os);
+      std::ostringstream report;
+      report
+          << "Borrowable " << this << " has been waiting more than "
+          << BorrowTracking::deadline().count() << "ms for "
+          << tally_.count() << " borrow(s) to be relinquished, "
+          << tracked << " of which were tracked:\n"
+          << os.str();
+      auto reporter = BorrowTracking::reporter();
+      if (reporter != nullptr) {
+        reporter(this, report.str());
+      } else {
+        LOG(WARNING) << report.str();
+      }
+      lock.lock();
+    }
+#endif
+
+    spot.condition.wait(lock, relinquished);
+
+    spot.parked.fetch_sub(1);
+  }
+
+  static void Unpark(const TypeErasedBorrowable* borrowable) {
+    auto& spot = ParkingSpotFor(borrowable);
+
+    if (spot.parked.load() > 0) {
+      // Acquire the lock so that we don't notify between a parking
+      // thread checking the tally and actually waiting.
+      std::lock_guard<std::mutex> lock(spot.mutex);
+
+      // NOTE: parking spots may be shared by more than one
+      // borrowable so we need to notify all of them.
+      spot.condition.notify_all();
+    }
+  }
+
+  std::atomic<bool> read_borrowed_ = false;
+
+  // See 'borrowed_weak'.
+  std::atomic<WeakControl*> weak_ = nullptr;
+
+  // See 'Extension'.
+  std::atomic<Extension*> extension_ = nullptr;
+
+#ifdef STOUT_BORROWABLE_STATS
+  BorrowableStats stats_{this};
+#endif
+
+  std::unique_ptr<Shard[]> shards_;
+  size_t shards_mask_ = 0;
+  bool biased_ = false;
+  bool single_threaded_ = false;
+
+  // See 'LimitBorrows()' and 'WatchBorrowsBelow()'.
+  static constexpr size_t kArming = std::numeric_limits<size_t>::max();
+
+  bool limited_ = false;
+  std::thread::id owner_;
+  std::atomic<Sharding> sharding_ = Sharding::Sharded;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// NOTE: relinquishing might invoke callbacks that defer (or flush)
+// more relinquishes so we always take a deferred borrowable out of
+// the table before relinquishing it.
+inline void DeferRelinquish::Flush() {
+  Table& table = Local();
+  while (table.size > 0) {
+    Deferred deferred = table.deferred[--table.size];
+    deferred.borrowable->Relinquish(deferred.borrows);
+  }
+}
+
+inline void DeferRelinquish::Flush(TypeErasedBorrowable* borrowable) {
+  // A thread only has deferred borrows while it's deferring.
+  if (Deferring().load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+
+  Table& table = Local();
+  for (size_t i = 0; i < table.size; i++) {
+    if (table.deferred[i].borrowable == borrowable) {
+      size_t borrows = table.deferred[i].borrows;
+      table.deferred[i] = table.deferred[--table.size];
+      borrowable->Relinquish(borrows);
+      return;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename Policy = Atomic>
+class Borrowable : public TypeErasedBorrowable {
+ public:
+  template <
+      typename... Args,
+      std::enable_if_t<std::is_constructible_v<T, Args...>, int> = 0>
+  Borrowable(Args&&... args)
+    : TypeErasedBorrowable(Policy()),
+      t_(std::forward<Args>(args)...) {
+    Describe<T>();
+  }
+
+  Borrowable(const Borrowable& that)
+    : TypeErasedBorrowable(that),
+      t_(that.t_) {
+    Describe<T>();
+  }
+
+  Borrowable(Borrowable&& that)
+    : TypeErasedBorrowable(std::move(that)),
+      t_(std::move(that.t_)) {
+    Describe<T>();
+  }
+
+  ~Borrowable() override {
+    // Expire any 'borrowed_weak' before 'T' gets destructed so that
+    // they can't borrow something that is being destructed.
+    Expire();
+  }
+
+  borrowed_ref<T> Borrow(
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (Increment(state)) {
+      return borrowed_ref<T>(*this, t_, Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  // Borrows unless there are already as many borrows as the limit
+  // (see 'LimitBorrows()') or borrowing isn't possible, e.g., while
+  // draining (see 'Drain()'), in which case returns an empty
+  // 'borrowed_ptr'.
+  borrowed_ptr<T> TryBorrow(
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (TryIncrement(state)) {
+      return borrowed_ptr<T>(this, &t_, Diagnose(location));
+    } else {
+      return borrowed_ptr<T>();
+    }
+  }
+
+  // Like 'Borrow()' except returns a borrow that only takes up a
+  // single pointer, see 'borrowed_compact_ptr'.
+  borrowed_compact_ptr<T, Policy> BorrowCompact(
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (Increment(state)) {
+      return borrowed_compact_ptr<T, Policy>(this, Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  // Borrows the elements of 'T', i.e., anything that works with
+  // 'std::data()' and 'std::size()' such as a 'std::vector' or an
+  // array, see 'borrowed_span'.
+  //
+  // NOTE: the span is of the elements at the time of borrowing, just
+  // like with a 'std::span' it's undefined behavior to access them
+  // after 'T' has been resized.
+  template <typename U = T>
+  borrowed_span<
+      std::remove_pointer_t<decltype(std::data(std::declval<U&>()))>>
+  BorrowSpan(const SourceLocation& location = SourceLocation::current()) {
+    using E = std::remove_pointer_t<decltype(std::data(t_))>;
+    auto state = State::Borrowing;
+    if (Increment(state)) {
+      return borrowed_span<E>(
+          this,
+          std::data(t_),
+          std::size(t_),
+          Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  // Borrows for reading without touching the tally, see
+  // 'borrowed_read_ref'.
+  borrowed_read_ref<T> Read() {
+    return borrowed_read_ref<T>(*this, t_);
+  }
+
+  // Shared and exclusive borrows act like a reader-writer lock that
+  // is part of the tally, i.e., borrowing (and relinquishing) costs a
+  // single atomic operation just like any other borrow. Any number of
+  // shared borrows can be outstanding at once, each of which can only
+  // read, while an exclusive borrow can only be made when there
+  // aren't any other borrows and is therefore safe to write through.
+  // 'BorrowShared()' and 'BorrowExclusive()' wait until they can
+  // borrow while the try variants return an empty borrow instead.
+  //
+  // NOTE: the tally counts an exclusive borrow just like any other
+  // borrow, e.g., for 'Watch()' or when destructing. Only 'Atomic'
+  // borrowables without a limit support shared and exclusive borrows.
+  // Exclusivity only covers borrows in the tally: an exclusive borrow
+  // waits for every outstanding borrow (including unused lease
+  // credits) but 'Borrow()', reborrowing (including 'borrowed_lease'
+  // taking more credits) and 'TryBorrow()' don't wait for (or exclude)
+  // an exclusive borrow, so only mix those with shared and exclusive
+  // borrows if that is safe for 'T'. Read borrows (see 'Read()') aren't
+  // in the tally at all so once read borrowed an exclusive borrow
+  // also waits for a grace period (and 'TryBorrowExclusive()' always
+  // returns an empty pointer), and it's an error to read borrow while
+  // exclusively borrowed.
+  //
+  // Shared borrows don't wait for a waiting exclusive borrow, i.e.,
+  // there is no writer preference, so a continuous stream of
+  // overlapping shared borrows can starve an exclusive borrow.
+  borrowed_ref<const T> BorrowShared(
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (IncrementShared(state, /* wait = */ true)) {
+      return borrowed_ref<const T>(*this, t_, Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  borrowed_ptr<const T> TryBorrowShared(
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (IncrementShared(state, /* wait = */ false)) {
+      return borrowed_ptr<const T>(this, &t_, Diagnose(location));
+    } else {
+      return borrowed_ptr<const T>();
+    }
+  }
+
+  borrowed_exclusive_ptr<T> BorrowExclusive(
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (IncrementExclusive(state, /* wait = */ true)) {
+      return borrowed_exclusive_ptr<T>(this, &t_, Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  borrowed_exclusive_ptr<T> TryBorrowExclusive(
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (IncrementExclusive(state, /* wait = */ false)) {
+      return borrowed_exclusive_ptr<T>(this, &t_, Diagnose(location));
+    } else {
+      return borrowed_exclusive_ptr<T>();
+    }
+  }
+
+  // Borrows 'n' times with a single atomic operation.
+  borrowed_batch<T> Borrow(size_t n) {
+    auto state = State::Borrowing;
+    if (n == 0 || Increment(state, n)) {
+      return borrowed_batch<T>(this, &t_, n);
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  // Leases blocks of 'credits' borrows at a time, see
+  // 'borrowed_lease'.
+  borrowed_lease<T> Lease(size_t credits) {
+    return borrowed_lease<T>(this, &t_, credits);
+  }
+
+  // Returns a 'borrowed_weak' that doesn't keep this borrowable from
+  // being destructed.
+  borrowed_weak<T> Weak() {
+    return borrowed_weak<T>(Weaken(), &t_);
+  }
+
+  template <
+      typename F,
+      std::enable_if_t<!std::is_integral_v<std::decay_t<F>>, int> = 0>
+  borrowed_callable<F> Borrow(
+      F&& f,
+      const SourceLocation& location = SourceLocation::current()) {
+    auto state = State::Borrowing;
+    if (Increment(state)) {
+      return borrowed_callable<F>(
+          std::forward<F>(f),
+          this,
+          Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  T* get() {
+    return &t_;
+  }
+
+  const T* get() const {
+    return &t_;
+  }
+
+  T* operator->() {
+    return get();
+  }
+
+  const T* operator->() const {
+    return get();
+  }
+
+  T& operator*() {
+    return t_;
+  }
+
+  const T& operator*() const {
+    return t_;
+  }
+
+ protected:
+  // Borrows and orphans with a single atomic operation, see
+  // 'IncrementAndOrphan()'.
+  borrowed_ref<T> BorrowOrphaned(
+      const SourceLocation& location = SourceLocation::current()) {
+    IncrementAndOrphan();
+    return borrowed_ref<T>(*this, t_, Diagnose(location));
+  }
+
+ private:
+  // See 'CacheAligned'.
+  static constexpr size_t kAlignment = IsCacheAligned<Policy>::value
+      ? std::max(alignof(T), size_t(64))
+      : alignof(T);
+
+  alignas(kAlignment) T t_;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// NOTE: with 'CacheAligned' the members of 'T' get put on their own
+// cache line(s) by padding, see 'CacheLinePadding'.
+template <typename T, typename Policy = Atomic>
+class enable_borrowable_from_this
+  : public TypeErasedBorrowable,
+    private CacheLinePadding<IsCacheAligned<Policy>::value> {
+ public:
+  borrowed_ref<T> Borrow(
+      const SourceLocation& location = SourceLocation::current()) {
+    static_assert(
+        std::is_base_of_v<enable_borrowable_from_this<T, Policy>, T>,
+        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+
+    auto state = State::Borrowing;
+    if (Increment(state)) {
+      return borrowed_ref<T>(
+          *this,
+          *static_cast<T*>(this),
+          Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  // Borrows unless there are already as many borrows as the limit
+  // (see 'LimitBorrows()') or borrowing isn't possible, e.g., while
+  // draining (see 'Drain()'), in which case returns an empty
+  // 'borrowed_ptr'.
+  borrowed_ptr<T> TryBorrow(
+      const SourceLocation& location = SourceLocation::current()) {
+    static_assert(
+        std::is_base_of_v<enable_borrowable_from_this<T, Policy>, T>,
+        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+
+    auto state = State::Borrowing;
+    if (TryIncrement(state)) {
+      return borrowed_ptr<T>(
+          this,
+          static_cast<T*>(this),
+          Diagnose(location));
+    } else {
+      return borrowed_ptr<T>();
+    }
+  }
+
+  // Borrows for reading without touching the tally, see
+  // 'borrowed_read_ref'.
+  borrowed_read_ref<T> Read() {
+    static_assert(
+        std::is_base_of_v<enable_borrowable_from_this<T, Policy>, T>,
+        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+
+    return borrowed_read_ref<T>(*this, *static_cast<T*>(this));
+  }
+
+  // Borrows 'n' times with a single atomic operation.
+  borrowed_batch<T> Borrow(size_t n) {
+    static_assert(
+        std::is_base_of_v<enable_borrowable_from_this<T, Policy>, T>,
+        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+
+    auto state = State::Borrowing;
+    if (n == 0 || Increment(state, n)) {
+      return borrowed_batch<T>(this, static_cast<T*>(this), n);
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+  // Leases blocks of 'credits' borrows at a time, see
+  // 'borrowed_lease'.
+  borrowed_lease<T> Lease(size_t credits) {
+    static_assert(
+        std::is_base_of_v<enable_borrowable_from_this<T, Policy>, T>,
+        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+
+    return borrowed_lease<T>(this, static_cast<T*>(this), credits);
+  }
+
+  // Returns a 'borrowed_weak' that doesn't keep this borrowable from
+  // being destructed.
+  //
+  // NOTE: unlike with 'Borrowable' the 'borrowed_weak' only expire
+  // after 'T' itself has been destructed, so 'T' must not be
+  // destructed while it might be borrowed through a 'borrowed_weak'.
+  borrowed_weak<T> Weak() {
+    static_assert(
+        std::is_base_of_v<enable_borrowable_from_this<T, Policy>, T>,
+        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+
+    return borrowed_weak<T>(Weaken(), static_cast<T*>(this));
+  }
+
+  template <
+      typename F,
+      std::enable_if_t<!std::is_integral_v<std::decay_t<F>>, int> = 0>
+  borrowed_callable<F> Borrow(
+      F&& f,
+      const SourceLocation& location = SourceLocation::current()) {
+    static_assert(
+        std::is_base_of_v<enable_borrowable_from_this<T, Policy>, T>,
+        "Type 'T' must derive from 'stout::enable_borrowable_from_this<T>'");
+
+    auto state = State::Borrowing;
+    if (Increment(state)) {
+      return borrowed_callable<F>(
+          std::forward<F>(f),
+          this,
+          Diagnose(location));
+    } else {
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
+    }
+  }
+
+ protected:
+  enable_borrowable_from_this()
+    : TypeErasedBorrowable(Policy()) {
+    Describe<T>();
+  }
+
+  enable_borrowable_from_this(const enable_borrowable_from_this& that)
+    : TypeErasedBorrowable(that) {
+    Describe<T>();
+  }
+
+  enable_borrowable_from_this(enable_borrowable_from_this&& that)
+    : TypeErasedBorrowable(std::move(that)) {
+    Describe<T>();
+  }
+};
+
+////////////////////////////////////////////////////////////////////////
 
 // Represents a borrowed reference to some borrowable of type
 // 'T'. Unlike 'borrowed_ptr' a 'borrowed_ref' acts like a raw
@@ -292,30 +2323,332 @@ class enable_borrowable_from_this : public TypeErasedBorrowable {
 // treat "use after move" as an error (which is what the clang-tidy
 // check does as well).
 template <typename T>
-class borrowed_ref final {
+class borrowed_ref final : private BorrowDiagnostics {
+ public:
+  // Deleted copy constructor to force use of 'reborrow()' which makes
+  // the copying more explicit!
+  borrowed_ref(const borrowed_ref& that) = delete;
+
+  borrowed_ref(borrowed_ref&& that) {
+    std::swap(borrowable_, CHECK_NOTNULL(that.borrowable_));
+    std::swap(t_, CHECK_NOTNULL(that.t_));
+    std::swap<BorrowDiagnostics>(*this, that);
+  }
+
+  ~borrowed_ref() {
+    // May have been moved!
+    if (borrowable_ != nullptr) {
+      borrowable_->Relinquish(diagnostics());
+    }
+  }
+
+  borrowed_ref& operator=(borrowed_ref&& that) {
+    std::swap(borrowable_, CHECK_NOTNULL(that.borrowable_));
+    std::swap(t_, CHECK_NOTNULL(that.t_));
+    std::swap<BorrowDiagnostics>(*this, that);
+    return *this;
+  }
+
+  template <
+      typename U,
+      std::enable_if_t<
+          std::conjunction_v<
+              std::negation<std::is_pointer<U>>,
+              std::negation<std::is_reference<U>>,
+              std::is_convertible<T*, U*>>,
+          int> = 0>
+  operator borrowed_ref<U>() const& {
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ref<U>(
+        *CHECK_NOTNULL(borrowable_),
+        *CHECK_NOTNULL(t_),
+        borrowable_->Diagnose(location()));
+  }
+
+  template <
+      typename U,
+      std::enable_if_t<
+          std::conjunction_v<
+              std::negation<std::is_pointer<U>>,
+              std::negation<std::is_reference<U>>,
+              std::is_convertible<T*, U*>>,
+          int> = 0>
+  operator borrowed_ref<U>() & {
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ref<U>(
+        *CHECK_NOTNULL(borrowable_),
+        *CHECK_NOTNULL(t_),
+        borrowable_->Diagnose(location()));
+  }
+
+  template <
+      typename U,
+      std::enable_if_t<
+          std::conjunction_v<
+              std::negation<std::is_pointer<U>>,
+              std::negation<std::is_reference<U>>,
+              std::is_convertible<T*, U*>>,
+          int> = 0>
+  operator borrowed_ref<U>() && {
+    // Don't reborrow since we're being moved!
+    TypeErasedBorrowable* borrowable = nullptr;
+    T* t = nullptr;
+    std::swap(borrowable, borrowable_);
+    std::swap(t, t_);
+    return borrowed_ptr<U>(borrowable, t, diagnostics());
+  }
+
+  template <
+      typename U,
+      std::enable_if_t<
+          std::conjunction_v<
+              std::negation<std::is_pointer<U>>,
+              std::negation<std::is_reference<U>>,
+              std::is_convertible<T*, U*>>,
+          int> = 0>
+  operator borrowed_ptr<U>() const& {
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ptr<U>(
+        CHECK_NOTNULL(borrowable_),
+        CHECK_NOTNULL(t_),
+        borrowable_->Diagnose(location()));
+  }
+
+  template <
+      typename U,
+      std::enable_if_t<
+          std::conjunction_v<
+              std::negation<std::is_pointer<U>>,
+              std::negation<std::is_reference<U>>,
+              std::is_convertible<T*, U*>>,
+          int> = 0>
+  operator borrowed_ptr<U>() & {
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ptr<U>(
+        CHECK_NOTNULL(borrowable_),
+        CHECK_NOTNULL(t_),
+        borrowable_->Diagnose(location()));
+  }
+
+  template <
+      typename U,
+      std::enable_if_t<
+          std::conjunction_v<
+              std::negation<std::is_pointer<U>>,
+              std::negation<std::is_reference<U>>,
+              std::is_convertible<T*, U*>>,
+          int> = 0>
+  operator borrowed_ptr<U>() && {
+    // Don't reborrow since we're being moved!
+    TypeErasedBorrowable* borrowable = nullptr;
+    T* t = nullptr;
+    std::swap(borrowable, borrowable_);
+    std::swap(t, t_);
+    return borrowed_ptr<U>(borrowable, t, diagnostics());
+  }
+
+  borrowed_ref reborrow(
+      const SourceLocation& location = SourceLocation::current()) const {
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ref<T>(
+        *CHECK_NOTNULL(borrowable_),
+        *CHECK_NOTNULL(t_),
+        borrowable_->Diagnose(location));
+  }
+
+  // Returns a 'borrowed_weak' of what this borrows, e.g., to keep in
+  // a cache without keeping the borrowable from being destructed.
+  borrowed_weak<T> weak() const {
+    return borrowed_weak<T>(CHECK_NOTNULL(borrowable_)->Weaken(), t_);
+  }
+
+  // 'alias()' are a set of helper(s) that return a borrow of what 'f'
+  // returns a reference to when invoked with 'T', e.g., a pointer to
+  // a member or a projection, which shares this borrow's borrowable
+  // (like the aliasing constructor of 'std::shared_ptr'). What 'f'
+  // returns must therefore live at least as long as 'T'.
+  template <typename F>
+  borrowed_ref<std::remove_reference_t<std::invoke_result_t<F, T&>>> alias(
+      F&& f,
+      const SourceLocation& location = SourceLocation::current()) const& {
+    static_assert(
+        std::is_lvalue_reference_v<std::invoke_result_t<F, T&>>,
+        "Can only alias what is returned by reference");
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ref<std::remove_reference_t<std::invoke_result_t<F, T&>>>(
+        *borrowable_,
+        std::invoke(std::forward<F>(f), *CHECK_NOTNULL(t_)),
+        borrowable_->Diagnose(location));
+  }
+
+  template <typename F>
+  borrowed_ref<std::remove_reference_t<std::invoke_result_t<F, T&>>> alias(
+      F&& f) && {
+    static_assert(
+        std::is_lvalue_reference_v<std::invoke_result_t<F, T&>>,
+        "Can only alias what is returned by reference");
+    // Don't reborrow since we're being moved!
+    TypeErasedBorrowable* borrowable = nullptr;
+    T* t = nullptr;
+    std::swap(borrowable, CHECK_NOTNULL(borrowable_));
+    std::swap(t, CHECK_NOTNULL(t_));
+    return borrowed_ref<std::remove_reference_t<std::invoke_result_t<F, T&>>>(
+        *borrowable,
+        std::invoke(std::forward<F>(f), *t),
+        diagnostics());
+  }
+
+  T* get() const {
+    return CHECK_NOTNULL(t_);
+  }
+
+  T* operator->() const {
+    return get();
+  }
+
+  T& operator*() const {
+    return *get();
+  }
+
+  // Indexes into 'T', e.g., a 'std::vector' or an array, see also
+  // 'borrowed_span'.
+  template <typename Index>
+  decltype(auto) operator[](Index&& index) const {
+    return (*get())[std::forward<Index>(index)];
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const borrowed_ref& that) {
+    return H::combine(std::move(h), &that.t_);
+  }
+
+ private:
+  template <typename>
+  friend class borrowed_ref;
+
+  template <typename>
+  friend class borrowed_ptr;
+
+  template <typename, typename>
+  friend class Borrowable;
+
+  template <typename, typename>
+  friend class enable_borrowable_from_this;
+
+  template <typename, typename>
+  friend class borrowed_compact_ptr;
+
+  borrowed_ref(
+      TypeErasedBorrowable& borrowable,
+      T& t,
+      const BorrowDiagnostics& diagnostics)
+    : BorrowDiagnostics(diagnostics),
+      borrowable_(&borrowable),
+      t_(&t) {}
+
+  TypeErasedBorrowable* borrowable_ = nullptr;
+  T* t_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// Represents a scoped read-only borrow of some borrowable of type
+// 'T' for read-mostly borrowables, e.g., routing tables or feature
+// flags, where even a single uncontended atomic operation for each
+// borrow and relinquish is too expensive. Instead of adding to the
+// tally a 'borrowed_read_ref' enters a read-side critical section
+// which only writes to thread-local state (see 'GracePeriod') and
+// destructing (or watching) the borrowable waits for a grace period
+// after which there can't be any outstanding 'borrowed_read_ref'.
+//
+// A 'borrowed_read_ref' can be neither copied nor moved and must be
+// destructed on the thread that it was borrowed on, hence it is only
+// suitable for short scoped reads, e.g.:
+//
+//   {
+//     auto table = routes.Read();
+//     ... table->Lookup(...);
+//   }
+//
+// NOTE: destructing (or moving, or watching) any read borrowed
+// borrowable while holding a 'borrowed_read_ref' on the same thread
+// will never finish waiting for a grace period and is an error.
+template <typename T>
+class borrowed_read_ref final {
+ public:
+  borrowed_read_ref(const borrowed_read_ref& that) = delete;
+  borrowed_read_ref(borrowed_read_ref&& that) = delete;
+
+  ~borrowed_read_ref() {
+    GracePeriod::Exit();
+  }
+
+  borrowed_read_ref& operator=(const borrowed_read_ref& that) = delete;
+  borrowed_read_ref& operator=(borrowed_read_ref&& that) = delete;
+
+  const T* get() const {
+    return t_;
+  }
+
+  const T* operator->() const {
+    return get();
+  }
+
+  const T& operator*() const {
+    return *get();
+  }
+
+ private:
+  template <typename, typename>
+  friend class Borrowable;
+
+  template <typename, typename>
+  friend class enable_borrowable_from_this;
+
+  borrowed_read_ref(TypeErasedBorrowable& borrowable, const T& t)
+    : t_(&t) {
+    borrowable.ReadBorrow();
+  }
+
+  const T* t_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// Like 'borrowed_ref' except similar to a raw pointer (and
+// 'std::unique_ptr') it can be a 'nullptr', for example, by
+// constructing a 'borrowed_ptr' with the default constructor or after
+// calling 'relinquish()'.
+template <typename T>
+class borrowed_ptr final : private BorrowDiagnostics {
  public:
+  borrowed_ptr() {}
+
   // Deleted copy constructor to force use of 'reborrow()' which makes
   // the copying more explicit!
-  borrowed_ref(const borrowed_ref& that) = delete;
+  borrowed_ptr(const borrowed_ptr& that) = delete;
 
-  borrowed_ref(borrowed_ref&& that) {
-    std::swap(borrowable_, CHECK_NOTNULL(that.borrowable_));
-    std::swap(t_, CHECK_NOTNULL(that.t_));
+  borrowed_ptr(borrowed_ptr&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(t_, that.t_);
+    std::swap<BorrowDiagnostics>(*this, that);
   }
 
-  ~borrowed_ref() {
-    // May have been moved!
-    if (borrowable_ != nullptr) {
-      borrowable_->Relinquish();
-    }
+  ~borrowed_ptr() {
+    relinquish();
   }
 
-  borrowed_ref& operator=(borrowed_ref&& that) {
-    std::swap(borrowable_, CHECK_NOTNULL(that.borrowable_));
-    std::swap(t_, CHECK_NOTNULL(that.t_));
+  borrowed_ptr& operator=(borrowed_ptr&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(t_, that.t_);
+    std::swap<BorrowDiagnostics>(*this, that);
     return *this;
   }
 
+  explicit operator bool() const {
+    return borrowable_ != nullptr;
+  }
+
   template <
       typename U,
       std::enable_if_t<
@@ -324,9 +2657,16 @@ class borrowed_ref final {
               std::negation<std::is_reference<U>>,
               std::is_convertible<T*, U*>>,
           int> = 0>
-  operator borrowed_ref<U>() const& {
-    CHECK_NOTNULL(borrowable_)->Reborrow();
-    return borrowed_ref<U>(*CHECK_NOTNULL(borrowable_), *CHECK_NOTNULL(t_));
+  operator borrowed_ptr<U>() const& {
+    if (borrowable_ != nullptr) {
+      borrowable_->Reborrow();
+      return borrowed_ptr<U>(
+          borrowable_,
+          t_,
+          borrowable_->Diagnose(location()));
+    } else {
+      return borrowed_ptr<U>();
+    }
   }
 
   template <
@@ -337,9 +2677,16 @@ class borrowed_ref final {
               std::negation<std::is_reference<U>>,
               std::is_convertible<T*, U*>>,
           int> = 0>
-  operator borrowed_ref<U>() & {
-    CHECK_NOTNULL(borrowable_)->Reborrow();
-    return borrowed_ref<U>(*CHECK_NOTNULL(borrowable_), *CHECK_NOTNULL(t_));
+  operator borrowed_ptr<U>() & {
+    if (borrowable_ != nullptr) {
+      borrowable_->Reborrow();
+      return borrowed_ptr<U>(
+          borrowable_,
+          t_,
+          borrowable_->Diagnose(location()));
+    } else {
+      return borrowed_ptr<U>();
+    }
   }
 
   template <
@@ -350,13 +2697,219 @@ class borrowed_ref final {
               std::negation<std::is_reference<U>>,
               std::is_convertible<T*, U*>>,
           int> = 0>
-  operator borrowed_ref<U>() && {
+  operator borrowed_ptr<U>() && {
     // Don't reborrow since we're being moved!
     TypeErasedBorrowable* borrowable = nullptr;
     T* t = nullptr;
     std::swap(borrowable, borrowable_);
     std::swap(t, t_);
-    return borrowed_ptr<U>(borrowable, t);
+    return borrowed_ptr<U>(borrowable, t, diagnostics());
+  }
+
+  // 'reference()' are a set of helper(s) that return a
+  // 'borrowed_ref<T>' after ensuring borrowable is non-null.
+  borrowed_ref<T> reference(
+      const SourceLocation& location = SourceLocation::current()) const& {
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ref<T>(
+        *CHECK_NOTNULL(borrowable_),
+        *CHECK_NOTNULL(t_),
+        borrowable_->Diagnose(location));
+  }
+
+  borrowed_ref<T> reference(
+      const SourceLocation& location = SourceLocation::current()) & {
+    CHECK_NOTNULL(borrowable_)->Reborrow();
+    return borrowed_ref<T>(
+        *CHECK_NOTNULL(borrowable_),
+        *CHECK_NOTNULL(t_),
+        borrowable_->Diagnose(location));
+  }
+
+  borrowed_ref<T> reference() && {
+    // Don't reborrow since we're being moved!
+    TypeErasedBorrowable* borrowable = nullptr;
+    T* t = nullptr;
+    std::swap(borrowable, CHECK_NOTNULL(borrowable_));
+    std::swap(t, CHECK_NOTNULL(t_));
+    return borrowed_ref<T>(
+        *CHECK_NOTNULL(borrowable),
+        *CHECK_NOTNULL(t),
+        diagnostics());
+  }
+
+  borrowed_ptr reborrow(
+      const SourceLocation& location = SourceLocation::current()) const {
+    if (borrowable_ != nullptr) {
+      borrowable_->Reborrow();
+      return borrowed_ptr<T>(borrowable_, t_, borrowable_->Diagnose(location));
+    } else {
+      return borrowed_ptr<T>();
+    }
+  }
+
+  // Returns a 'borrowed_weak' of what this borrows (or an empty
+  // 'borrowed_weak' if this is empty), see 'borrowed_ref::weak()'.
+  borrowed_weak<T> weak() const {
+    if (borrowable_ != nullptr) {
+      return borrowed_weak<T>(borrowable_->Weaken(), t_);
+    } else {
+      return borrowed_weak<T>();
+    }
+  }
+
+  // 'alias()' are a set of helper(s) that return a borrow of what 'f'
+  // returns a reference to when invoked with 'T', see
+  // 'borrowed_ref::alias()', or an empty 'borrowed_ptr' if this is
+  // empty (in which case 'f' doesn't get invoked).
+  template <typename F>
+  borrowed_ptr<std::remove_reference_t<std::invoke_result_t<F, T&>>> alias(
+      F&& f,
+      const SourceLocation& location = SourceLocation::current()) const& {
+    using U = std::remove_reference_t<std::invoke_result_t<F, T&>>;
+    static_assert(
+        std::is_lvalue_reference_v<std::invoke_result_t<F, T&>>,
+        "Can only alias what is returned by reference");
+    if (borrowable_ != nullptr) {
+      borrowable_->Reborrow();
+      return borrowed_ptr<U>(
+          borrowable_,
+          std::addressof(std::invoke(std::forward<F>(f), *t_)),
+          borrowable_->Diagnose(location));
+    } else {
+      return borrowed_ptr<U>();
+    }
+  }
+
+  template <typename F>
+  borrowed_ptr<std::remove_reference_t<std::invoke_result_t<F, T&>>> alias(
+      F&& f) && {
+    using U = std::remove_reference_t<std::invoke_result_t<F, T&>>;
+    static_assert(
+        std::is_lvalue_reference_v<std::invoke_result_t<F, T&>>,
+        "Can only alias what is returned by reference");
+    if (borrowable_ != nullptr) {
+      // Don't reborrow since we're being moved!
+      TypeErasedBorrowable* borrowable = nullptr;
+      T* t = nullptr;
+      std::swap(borrowable, borrowable_);
+      std::swap(t, t_);
+      return borrowed_ptr<U>(
+          borrowable,
+          std::addressof(std::invoke(std::forward<F>(f), *t)),
+          diagnostics());
+    } else {
+      return borrowed_ptr<U>();
+    }
+  }
+
+  void relinquish() {
+    if (borrowable_ != nullptr) {
+      borrowable_->Relinquish(diagnostics());
+      borrowable_ = nullptr;
+      t_ = nullptr;
+    }
+  }
+
+  T* get() const {
+    return t_;
+  }
+
+  T* operator->() const {
+    return get();
+  }
+
+  T& operator*() const {
+    // NOTE: just like with 'std::unique_ptr' the behavior is
+    // undefined if 'get() == nullptr'.
+    return *get();
+  }
+
+  // Indexes into 'T', e.g., a 'std::vector' or an array, see also
+  // 'borrowed_span'.
+  template <typename Index>
+  decltype(auto) operator[](Index&& index) const {
+    return (*get())[std::forward<Index>(index)];
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const borrowed_ptr& that) {
+    return H::combine(std::move(h), that.t_);
+  }
+
+ private:
+  template <typename>
+  friend class borrowed_ptr;
+
+  template <typename>
+  friend class borrowed_ref;
+
+  template <typename, typename>
+  friend class Borrowable;
+
+  template <typename, typename>
+  friend class enable_borrowable_from_this;
+
+  template <typename>
+  friend class borrowed_batch;
+
+  template <typename>
+  friend class borrowed_lease;
+
+  template <typename>
+  friend class borrowed_weak;
+
+  template <typename, typename>
+  friend class borrowed_compact_ptr;
+
+  borrowed_ptr(
+      TypeErasedBorrowable* borrowable,
+      T* t,
+      const BorrowDiagnostics& diagnostics)
+    : BorrowDiagnostics(diagnostics),
+      borrowable_(borrowable),
+      t_(t) {}
+
+  TypeErasedBorrowable* borrowable_ = nullptr;
+  T* t_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// A 'borrowed_ptr' to the 'T' of a 'Borrowable<T, Policy>' that only
+// takes up a single pointer (unless statistics or tracking have been
+// enabled) because 'T' is always at the same offset within its
+// borrowable, e.g., for keeping lots of borrows in vectors or queues.
+//
+// Anything that might refer to something other than the 'T' of a
+// borrowable, e.g., upcasting, requires converting to a 'borrowed_ptr'
+// (or a 'borrowed_ref' via 'reference()') which takes up two pointers.
+template <typename T, typename Policy = Atomic>
+class borrowed_compact_ptr final : private BorrowDiagnostics {
+ public:
+  borrowed_compact_ptr() {}
+
+  // Deleted copy constructor to force use of 'reborrow()' which makes
+  // the copying more explicit!
+  borrowed_compact_ptr(const borrowed_compact_ptr& that) = delete;
+
+  borrowed_compact_ptr(borrowed_compact_ptr&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap<BorrowDiagnostics>(*this, that);
+  }
+
+  ~borrowed_compact_ptr() {
+    relinquish();
+  }
+
+  borrowed_compact_ptr& operator=(borrowed_compact_ptr&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap<BorrowDiagnostics>(*this, that);
+    return *this;
+  }
+
+  explicit operator bool() const {
+    return borrowable_ != nullptr;
   }
 
   template <
@@ -368,8 +2921,15 @@ class borrowed_ref final {
               std::is_convertible<T*, U*>>,
           int> = 0>
   operator borrowed_ptr<U>() const& {
-    CHECK_NOTNULL(borrowable_)->Reborrow();
-    return borrowed_ptr<U>(CHECK_NOTNULL(borrowable_), CHECK_NOTNULL(t_));
+    if (borrowable_ != nullptr) {
+      borrowable_->Reborrow();
+      return borrowed_ptr<U>(
+          borrowable_,
+          get(),
+          borrowable_->Diagnose(location()));
+    } else {
+      return borrowed_ptr<U>();
+    }
   }
 
   template <
@@ -380,192 +2940,418 @@ class borrowed_ref final {
               std::negation<std::is_reference<U>>,
               std::is_convertible<T*, U*>>,
           int> = 0>
-  operator borrowed_ptr<U>() & {
+  operator borrowed_ptr<U>() && {
+    // Don't reborrow since we're being moved!
+    if (borrowable_ != nullptr) {
+      T* t = get();
+      return borrowed_ptr<U>(
+          std::exchange(borrowable_, nullptr),
+          t,
+          diagnostics());
+    } else {
+      return borrowed_ptr<U>();
+    }
+  }
+
+  // 'reference()' are a set of helper(s) that return a
+  // 'borrowed_ref<T>' after ensuring borrowable is non-null.
+  borrowed_ref<T> reference(
+      const SourceLocation& location = SourceLocation::current()) const& {
     CHECK_NOTNULL(borrowable_)->Reborrow();
-    return borrowed_ptr<U>(CHECK_NOTNULL(borrowable_), CHECK_NOTNULL(t_));
+    return borrowed_ref<T>(
+        *borrowable_,
+        **borrowable_,
+        borrowable_->Diagnose(location));
+  }
+
+  borrowed_ref<T> reference() && {
+    // Don't reborrow since we're being moved!
+    auto* borrowable = std::exchange(CHECK_NOTNULL(borrowable_), nullptr);
+    return borrowed_ref<T>(*borrowable, **borrowable, diagnostics());
+  }
+
+  borrowed_compact_ptr reborrow(
+      const SourceLocation& location = SourceLocation::current()) const {
+    if (borrowable_ != nullptr) {
+      borrowable_->Reborrow();
+      return borrowed_compact_ptr(
+          borrowable_,
+          borrowable_->Diagnose(location));
+    } else {
+      return borrowed_compact_ptr();
+    }
+  }
+
+  void relinquish() {
+    if (borrowable_ != nullptr) {
+      borrowable_->Relinquish(diagnostics());
+      borrowable_ = nullptr;
+    }
+  }
+
+  T* get() const {
+    return borrowable_ != nullptr ? &**borrowable_ : nullptr;
+  }
+
+  T* operator->() const {
+    return get();
+  }
+
+  T& operator*() const {
+    // NOTE: just like with 'std::unique_ptr' the behavior is
+    // undefined if 'get() == nullptr'.
+    return **borrowable_;
+  }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const borrowed_compact_ptr& that) {
+    return H::combine(std::move(h), that.get());
+  }
+
+ private:
+  template <typename, typename>
+  friend class Borrowable;
+
+  borrowed_compact_ptr(
+      Borrowable<T, Policy>* borrowable,
+      const BorrowDiagnostics& diagnostics)
+    : BorrowDiagnostics(diagnostics),
+      borrowable_(borrowable) {}
+
+  Borrowable<T, Policy>* borrowable_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// Represents a borrow of a contiguous range of 'T', e.g., the
+// elements of a 'Borrowable<std::vector<T>>' (see 'BorrowSpan()'),
+// much like a 'std::span' except that it holds a borrow. A span can
+// be split into smaller spans without copying any elements, e.g., to
+// hand out chunks of a buffer to parallel workers which each hold
+// their own borrow, see 'subspan()' and 'split()'.
+//
+// Iterators are just pointers so that loops over a span can be
+// vectorized just like loops over an array.
+template <typename T>
+class borrowed_span final : private BorrowDiagnostics {
+ public:
+  using element_type = T;
+  using value_type = std::remove_cv_t<T>;
+  using size_type = size_t;
+  using pointer = T*;
+  using reference = T&;
+  using iterator = T*;
+
+  borrowed_span() {}
+
+  // Deleted copy constructor to force use of 'reborrow()' which makes
+  // the copying more explicit!
+  borrowed_span(const borrowed_span& that) = delete;
+
+  borrowed_span(borrowed_span&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(data_, that.data_);
+    std::swap(size_, that.size_);
+    std::swap<BorrowDiagnostics>(*this, that);
+  }
+
+  ~borrowed_span() {
+    relinquish();
+  }
+
+  borrowed_span& operator=(borrowed_span&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(data_, that.data_);
+    std::swap(size_, that.size_);
+    std::swap<BorrowDiagnostics>(*this, that);
+    return *this;
+  }
+
+  explicit operator bool() const {
+    return borrowable_ != nullptr;
   }
 
+  // Converts to a span of 'const T'.
   template <
       typename U,
-      std::enable_if_t<
-          std::conjunction_v<
-              std::negation<std::is_pointer<U>>,
-              std::negation<std::is_reference<U>>,
-              std::is_convertible<T*, U*>>,
-          int> = 0>
-  operator borrowed_ptr<U>() && {
+      std::enable_if_t<std::is_convertible_v<T (*)[], U (*)[]>, int> = 0>
+  operator borrowed_span<U>() && {
     // Don't reborrow since we're being moved!
-    TypeErasedBorrowable* borrowable = nullptr;
-    T* t = nullptr;
-    std::swap(borrowable, borrowable_);
-    std::swap(t, t_);
-    return borrowed_ptr<U>(borrowable, t);
+    return borrowed_span<U>(
+        std::exchange(borrowable_, nullptr),
+        std::exchange(data_, nullptr),
+        std::exchange(size_, 0),
+        diagnostics());
+  }
+
+  T* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
   }
 
-  borrowed_ref reborrow() const {
-    CHECK_NOTNULL(borrowable_)->Reborrow();
-    return borrowed_ref<T>(*CHECK_NOTNULL(borrowable_), *CHECK_NOTNULL(t_));
+  T& operator[](size_t index) const {
+    // NOTE: just like with 'std::span' the behavior is undefined if
+    // 'index >= size()'.
+    return data_[index];
   }
 
-  T* get() const {
-    return CHECK_NOTNULL(t_);
+  T* begin() const {
+    return data_;
   }
 
-  T* operator->() const {
-    return get();
+  T* end() const {
+    return data_ + size_;
   }
 
-  T& operator*() const {
-    return *get();
+  borrowed_span reborrow(
+      const SourceLocation& location = SourceLocation::current()) const {
+    return subspan(0, size_, location);
   }
 
-  // TODO(benh): operator[]
+  // Returns a (reborrowed) span of 'count' elements starting at
+  // 'offset'.
+  borrowed_span subspan(
+      size_t offset,
+      size_t count,
+      const SourceLocation& location = SourceLocation::current()) const {
+    if (borrowable_ != nullptr) {
+      CHECK_LE(offset, size_);
+      CHECK_LE(count, size_ - offset);
+      borrowable_->Reborrow();
+      return borrowed_span(
+          borrowable_,
+          data_ + offset,
+          count,
+          borrowable_->Diagnose(location));
+    } else {
+      return borrowed_span();
+    }
+  }
 
-  template <typename H>
-  friend H AbslHashValue(H h, const borrowed_ref& that) {
-    return H::combine(std::move(h), &that.t_);
+  // Splits into 'n' spans of (almost) the same size that together
+  // cover this span, reborrowing all of them with a single atomic
+  // operation. Splitting an empty span returns 'n' empty spans, just
+  // like 'subspan()' returns an empty span.
+  std::vector<borrowed_span> split(
+      size_t n,
+      const SourceLocation& location = SourceLocation::current()) const {
+    CHECK_GT(n, 0u);
+
+    std::vector<borrowed_span> spans;
+    spans.reserve(n);
+
+    if (borrowable_ == nullptr) {
+      spans.resize(n);
+      return spans;
+    }
+
+    borrowable_->Reborrow(n);
+
+    size_t offset = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      size_t count = size_ / n + (i < size_ % n ? 1 : 0);
+      spans.push_back(borrowed_span(
+          borrowable_,
+          data_ + offset,
+          count,
+          borrowable_->Diagnose(location)));
+      offset += count;
+    }
+
+    return spans;
   }
 
- private:
-  template <typename>
-  friend class borrowed_ref;
+  void relinquish() {
+    if (borrowable_ != nullptr) {
+      borrowable_->Relinquish(diagnostics());
+      borrowable_ = nullptr;
+      data_ = nullptr;
+      size_ = 0;
+    }
+  }
 
+ private:
   template <typename>
-  friend class borrowed_ptr;
+  friend class borrowed_span;
 
-  template <typename>
+  template <typename, typename>
   friend class Borrowable;
 
-  template <typename>
-  friend class enable_borrowable_from_this;
-
-  borrowed_ref(TypeErasedBorrowable& borrowable, T& t)
-    : borrowable_(&borrowable),
-      t_(&t) {}
+  borrowed_span(
+      TypeErasedBorrowable* borrowable,
+      T* data,
+      size_t size,
+      const BorrowDiagnostics& diagnostics)
+    : BorrowDiagnostics(diagnostics),
+      borrowable_(borrowable),
+      data_(data),
+      size_(size) {}
 
   TypeErasedBorrowable* borrowable_ = nullptr;
-  T* t_ = nullptr;
+  T* data_ = nullptr;
+  size_t size_ = 0;
 };
 
 ////////////////////////////////////////////////////////////////////////
 
-// Like 'borrowed_ref' except similar to a raw pointer (and
-// 'std::unique_ptr') it can be a 'nullptr', for example, by
-// constructing a 'borrowed_ptr' with the default constructor or after
-// calling 'relinquish()'.
+// A lease of borrows for handing out (and taking back) lots of
+// borrows of the same borrowable without any atomic operations, e.g.,
+// for a worker thread that keeps reborrowing the same objects. A
+// lease acquires a block of credits (i.e., borrows) at a time with a
+// single atomic operation, 'take()' hands out a credit as a
+// 'borrowed_ptr' and 'give_back()' takes a borrow back as a credit
+// instead of relinquishing it. Unused credits get relinquished with
+// a single atomic operation by 'flush()' or when destructed.
+//
+// NOTE: unused credits are outstanding borrows like any others, so a
+// 'Watch()' callback won't get invoked (and a destructor won't
+// return) until every lease has been flushed (or destructed), and
+// after flushing a lease must not be used again unless the
+// borrowable is still alive. A lease isn't thread-safe, i.e., each
+// thread needs its own.
 template <typename T>
-class borrowed_ptr final {
+class borrowed_lease final {
  public:
-  borrowed_ptr() {}
+  borrowed_lease() {}
 
-  // Deleted copy constructor to force use of 'reborrow()' which makes
-  // the copying more explicit!
-  borrowed_ptr(const borrowed_ptr& that) = delete;
+  borrowed_lease(const borrowed_lease& that) = delete;
 
-  borrowed_ptr(borrowed_ptr&& that) {
+  borrowed_lease(borrowed_lease&& that) {
     std::swap(borrowable_, that.borrowable_);
     std::swap(t_, that.t_);
+    std::swap(block_, that.block_);
+    std::swap(credits_, that.credits_);
   }
 
-  ~borrowed_ptr() {
-    relinquish();
+  ~borrowed_lease() {
+    flush();
   }
 
-  borrowed_ptr& operator=(borrowed_ptr&& that) {
+  borrowed_lease& operator=(borrowed_lease&& that) {
     std::swap(borrowable_, that.borrowable_);
     std::swap(t_, that.t_);
+    std::swap(block_, that.block_);
+    std::swap(credits_, that.credits_);
     return *this;
   }
 
-  explicit operator bool() const {
-    return borrowable_ != nullptr;
+  // Number of unused credits.
+  size_t credits() const {
+    return credits_;
   }
 
-  template <
-      typename U,
-      std::enable_if_t<
-          std::conjunction_v<
-              std::negation<std::is_pointer<U>>,
-              std::negation<std::is_reference<U>>,
-              std::is_convertible<T*, U*>>,
-          int> = 0>
-  operator borrowed_ptr<U>() const& {
-    if (borrowable_ != nullptr) {
-      borrowable_->Reborrow();
-      return borrowed_ptr<U>(borrowable_, t_);
-    } else {
-      return borrowed_ptr<U>();
+  // Hands out a credit, acquiring another block of credits first if
+  // there aren't any left.
+  borrowed_ptr<T> take(
+      const SourceLocation& location = SourceLocation::current()) {
+    CHECK_NOTNULL(borrowable_);
+
+    if (credits_ == 0) {
+      Acquire();
     }
+
+    credits_--;
+
+    return borrowed_ptr<T>(borrowable_, t_, borrowable_->Diagnose(location));
   }
 
-  template <
-      typename U,
-      std::enable_if_t<
-          std::conjunction_v<
-              std::negation<std::is_pointer<U>>,
-              std::negation<std::is_reference<U>>,
-              std::is_convertible<T*, U*>>,
-          int> = 0>
-  operator borrowed_ptr<U>() & {
-    if (borrowable_ != nullptr) {
-      borrowable_->Reborrow();
-      return borrowed_ptr<U>(borrowable_, t_);
-    } else {
-      return borrowed_ptr<U>();
+  // Takes back a borrow (which must be of the same borrowable) as a
+  // credit rather than relinquishing it.
+  void give_back(borrowed_ptr<T>&& borrowed) {
+    if (borrowed.borrowable_ != nullptr) {
+      CHECK_EQ(borrowed.borrowable_, borrowable_)
+          << "Can only give back a borrow of the leased borrowable";
+      borrowable_->Untrack(borrowed.diagnostics());
+      borrowed.borrowable_ = nullptr;
+      borrowed.t_ = nullptr;
+      credits_++;
     }
   }
 
-  template <
-      typename U,
-      std::enable_if_t<
-          std::conjunction_v<
-              std::negation<std::is_pointer<U>>,
-              std::negation<std::is_reference<U>>,
-              std::is_convertible<T*, U*>>,
-          int> = 0>
-  operator borrowed_ptr<U>() && {
-    // Don't reborrow since we're being moved!
-    TypeErasedBorrowable* borrowable = nullptr;
-    T* t = nullptr;
-    std::swap(borrowable, borrowable_);
-    std::swap(t, t_);
-    return borrowed_ptr<U>(borrowable, t);
+  // Relinquishes all unused credits.
+  void flush() {
+    if (credits_ > 0) {
+      CHECK_NOTNULL(borrowable_)->Relinquish(credits_);
+      credits_ = 0;
+    }
   }
 
-  // 'reference()' are a set of helper(s) that return a
-  // 'borrowed_ref<T>' after ensuring borrowable is non-null.
-  borrowed_ref<T> reference() const& {
-    CHECK_NOTNULL(borrowable_)->Reborrow();
-    return borrowed_ref<T>(*CHECK_NOTNULL(borrowable_), *CHECK_NOTNULL(t_));
-  }
+ private:
+  template <typename, typename>
+  friend class Borrowable;
 
-  borrowed_ref<T> reference() & {
-    CHECK_NOTNULL(borrowable_)->Reborrow();
-    return borrowed_ref<T>(*CHECK_NOTNULL(borrowable_), *CHECK_NOTNULL(t_));
-  }
+  template <typename, typename>
+  friend class enable_borrowable_from_this;
 
-  borrowed_ref<T> reference() && {
-    // Don't reborrow since we're being moved!
-    TypeErasedBorrowable* borrowable = nullptr;
-    T* t = nullptr;
-    std::swap(borrowable, CHECK_NOTNULL(borrowable_));
-    std::swap(t, CHECK_NOTNULL(t_));
-    return borrowed_ref<T>(*CHECK_NOTNULL(borrowable), *CHECK_NOTNULL(t));
+  borrowed_lease(TypeErasedBorrowable* borrowable, T* t, size_t block)
+    : borrowable_(borrowable),
+      t_(t),
+      block_(block) {
+    CHECK_GT(block_, 0u);
+    Acquire();
   }
 
-  borrowed_ptr reborrow() const {
-    if (borrowable_ != nullptr) {
-      borrowable_->Reborrow();
-      return borrowed_ptr<T>(borrowable_, t_);
+  void Acquire() {
+    auto state = TypeErasedBorrowable::State::Borrowing;
+    if (borrowable_->Increment(state, block_)) {
+      credits_ += block_;
     } else {
-      return borrowed_ptr<T>();
+      // Why are you borrowing when you shouldn't be?
+      LOG(FATAL) << "Attempting to borrow in state " << state;
     }
   }
 
+  TypeErasedBorrowable* borrowable_ = nullptr;
+  T* t_ = nullptr;
+  size_t block_ = 0;
+  size_t credits_ = 0;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// An exclusive borrow of some borrowable of type 'T', i.e., there
+// aren't any other borrows for as long as it's outstanding, see
+// 'Borrowable::BorrowExclusive()'. Since it's exclusive it can be
+// moved but not reborrowed.
+template <typename T>
+class borrowed_exclusive_ptr final : private BorrowDiagnostics {
+ public:
+  borrowed_exclusive_ptr() {}
+
+  borrowed_exclusive_ptr(const borrowed_exclusive_ptr& that) = delete;
+
+  borrowed_exclusive_ptr(borrowed_exclusive_ptr&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(t_, that.t_);
+    std::swap<BorrowDiagnostics>(*this, that);
+  }
+
+  ~borrowed_exclusive_ptr() {
+    relinquish();
+  }
+
+  borrowed_exclusive_ptr& operator=(borrowed_exclusive_ptr&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(t_, that.t_);
+    std::swap<BorrowDiagnostics>(*this, that);
+    return *this;
+  }
+
+  explicit operator bool() const {
+    return borrowable_ != nullptr;
+  }
+
   void relinquish() {
     if (borrowable_ != nullptr) {
-      borrowable_->Relinquish();
-      borrowable_ = nullptr;
+      std::exchange(borrowable_, nullptr)->RelinquishExclusive(diagnostics());
       t_ = nullptr;
     }
   }
@@ -584,29 +3370,269 @@ class borrowed_ptr final {
     return *get();
   }
 
-  // TODO(benh): operator[]
+ private:
+  template <typename, typename>
+  friend class Borrowable;
+
+  borrowed_exclusive_ptr(
+      TypeErasedBorrowable* borrowable,
+      T* t,
+      const BorrowDiagnostics& diagnostics)
+    : BorrowDiagnostics(diagnostics),
+      borrowable_(borrowable),
+      t_(t) {}
 
-  template <typename H>
-  friend H AbslHashValue(H h, const borrowed_ptr& that) {
-    return H::combine(std::move(h), that.t_);
+  TypeErasedBorrowable* borrowable_ = nullptr;
+  T* t_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// A weak reference to some borrowable of type 'T' that, unlike a
+// 'borrowed_ptr', doesn't count as a borrow and therefore never keeps
+// the borrowable from being destructed, e.g., for caches of
+// borrowables that are owned elsewhere. 'try_borrow()' borrows just
+// like 'TryBorrow()' except that it returns an empty 'borrowed_ptr'
+// once the borrowable has started destructing.
+//
+// A 'borrowed_weak' never touches the borrowable itself unless it
+// can borrow, instead it shares a small control block with the
+// borrowable (allocated when the first 'borrowed_weak' gets made)
+// that the borrowable expires when destructing, so it's safe to keep
+// a 'borrowed_weak' after the borrowable's memory has been freed
+// (or reused, e.g., by a 'BorrowablePool').
+template <typename T>
+class borrowed_weak final {
+ public:
+  borrowed_weak() {}
+
+  borrowed_weak(const borrowed_weak& that)
+    : weak_(that.weak_),
+      t_(that.t_) {
+    if (weak_ != nullptr) {
+      weak_->Reference();
+    }
+  }
+
+  borrowed_weak(borrowed_weak&& that) {
+    std::swap(weak_, that.weak_);
+    std::swap(t_, that.t_);
+  }
+
+  template <
+      typename U,
+      std::enable_if_t<std::is_convertible_v<U*, T*>, int> = 0>
+  borrowed_weak(const borrowed_weak<U>& that)
+    : weak_(that.weak_),
+      t_(that.t_) {
+    if (weak_ != nullptr) {
+      weak_->Reference();
+    }
+  }
+
+  ~borrowed_weak() {
+    reset();
+  }
+
+  borrowed_weak& operator=(borrowed_weak that) {
+    std::swap(weak_, that.weak_);
+    std::swap(t_, that.t_);
+    return *this;
+  }
+
+  // Returns true if the borrowable has started destructing (or this
+  // is empty), i.e., 'try_borrow()' will always fail from now on.
+  //
+  // NOTE: 'try_borrow()' might still fail when this returns false,
+  // e.g., because the borrowable is being watched or drained.
+  bool expired() const {
+    return weak_ == nullptr || weak_->expired();
+  }
+
+  // Borrows unless the borrowable has started destructing, or
+  // 'TryBorrow()' would fail, in which case returns an empty
+  // 'borrowed_ptr'.
+  borrowed_ptr<T> try_borrow(
+      const SourceLocation& location = SourceLocation::current()) const {
+    if (weak_ == nullptr) {
+      return borrowed_ptr<T>();
+    }
+
+    TypeErasedBorrowable* borrowable = weak_->Pin();
+
+    if (borrowable == nullptr) {
+      return borrowed_ptr<T>();
+    }
+
+    auto state = TypeErasedBorrowable::State::Borrowing;
+    bool borrowed = borrowable->TryIncrement(state);
+
+    // Once borrowed our borrow keeps the borrowable alive.
+    weak_->Unpin();
+
+    if (borrowed) {
+      return borrowed_ptr<T>(borrowable, t_, borrowable->Diagnose(location));
+    } else {
+      return borrowed_ptr<T>();
+    }
+  }
+
+  void reset() {
+    if (weak_ != nullptr) {
+      std::exchange(weak_, nullptr)->Unreference();
+      t_ = nullptr;
+    }
   }
 
  private:
   template <typename>
-  friend class borrowed_ptr;
+  friend class borrowed_weak;
 
   template <typename>
   friend class borrowed_ref;
 
   template <typename>
+  friend class borrowed_ptr;
+
+  template <typename, typename>
   friend class Borrowable;
 
-  borrowed_ptr(TypeErasedBorrowable* borrowable, T* t)
-    : borrowable_(borrowable),
+  template <typename, typename>
+  friend class enable_borrowable_from_this;
+
+  // Takes over the reference to 'weak', see 'Weaken()'.
+  borrowed_weak(TypeErasedBorrowable::WeakControl* weak, T* t)
+    : weak_(weak),
       t_(t) {}
 
+  TypeErasedBorrowable::WeakControl* weak_ = nullptr;
+  T* t_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// A move-only batch of borrows returned from 'Borrow(size_t n)'
+// which were all borrowed with a single atomic operation. Each
+// borrow can be taken out of the batch as a 'borrowed_ptr' (which
+// will relinquish just that borrow as usual) without any atomic
+// operations, and any borrows still left in the batch get
+// relinquished with a single atomic operation when calling
+// 'relinquish()' or when destructed.
+//
+// A batch can also be iterated over which takes each borrow out of
+// the batch, e.g.:
+//
+//   for (borrowed_ptr<T> borrowed : borrowable.Borrow(4)) {
+//     ...
+//   }
+template <typename T>
+class borrowed_batch final {
+ public:
+  class iterator final {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = borrowed_ptr<T>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = borrowed_ptr<T>;
+
+    borrowed_ptr<T> operator*() const {
+      return CHECK_NOTNULL(batch_)->take();
+    }
+
+    iterator& operator++() {
+      return *this;
+    }
+
+    bool operator==(const iterator& that) const {
+      return empty() == that.empty();
+    }
+
+    bool operator!=(const iterator& that) const {
+      return !(*this == that);
+    }
+
+   private:
+    friend class borrowed_batch;
+
+    explicit iterator(borrowed_batch* batch)
+      : batch_(batch) {}
+
+    bool empty() const {
+      return batch_ == nullptr || batch_->empty();
+    }
+
+    borrowed_batch* batch_ = nullptr;
+  };
+
+  borrowed_batch() {}
+
+  borrowed_batch(const borrowed_batch& that) = delete;
+
+  borrowed_batch(borrowed_batch&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(t_, that.t_);
+    std::swap(size_, that.size_);
+  }
+
+  ~borrowed_batch() {
+    relinquish();
+  }
+
+  borrowed_batch& operator=(borrowed_batch&& that) {
+    std::swap(borrowable_, that.borrowable_);
+    std::swap(t_, that.t_);
+    std::swap(size_, that.size_);
+    return *this;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  // Takes a single borrow out of the batch.
+  borrowed_ptr<T> take(
+      const SourceLocation& location = SourceLocation::current()) {
+    CHECK_GT(size_, 0u);
+    size_--;
+    return borrowed_ptr<T>(borrowable_, t_, borrowable_->Diagnose(location));
+  }
+
+  // Relinquishes all of the borrows still left in the batch.
+  void relinquish() {
+    if (size_ > 0) {
+      CHECK_NOTNULL(borrowable_)->Relinquish(size_);
+      size_ = 0;
+    }
+  }
+
+  iterator begin() {
+    return iterator(this);
+  }
+
+  iterator end() {
+    return iterator(nullptr);
+  }
+
+ private:
+  template <typename, typename>
+  friend class Borrowable;
+
+  template <typename, typename>
+  friend class enable_borrowable_from_this;
+
+  borrowed_batch(TypeErasedBorrowable* borrowable, T* t, size_t size)
+    : borrowable_(borrowable),
+      t_(t),
+      size_(size) {}
+
   TypeErasedBorrowable* borrowable_ = nullptr;
   T* t_ = nullptr;
+  size_t size_ = 0;
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -614,14 +3640,22 @@ class borrowed_ptr final {
 // Helper type that is callable and handles ensuring a 'borrowed_ptr'
 // is borrowed until the callable is destructed.
 template <typename F>
-class borrowed_callable final {
+class borrowed_callable final : private BorrowDiagnostics {
  public:
-  borrowed_callable(F f, TypeErasedBorrowable* borrowable)
-    : f_(std::move(f)),
+  borrowed_callable(
+      F f,
+      TypeErasedBorrowable* borrowable,
+      const BorrowDiagnostics& diagnostics = BorrowDiagnostics())
+    : BorrowDiagnostics(diagnostics),
+      f_(std::move(f)),
       borrowable_(CHECK_NOTNULL(borrowable)) {}
 
   borrowed_callable(const borrowed_callable& that)
-    : f_(that.f_),
+    : BorrowDiagnostics(
+        that.borrowable_ != nullptr
+            ? that.borrowable_->Diagnose(that.location())
+            : BorrowDiagnostics()),
+      f_(that.f_),
       borrowable_([&]() -> TypeErasedBorrowable* {
         if (that.borrowable_ != nullptr) {
           that.borrowable_->Reborrow();
@@ -634,11 +3668,12 @@ class borrowed_callable final {
   borrowed_callable(borrowed_callable&& that)
     : f_(std::move(that.f_)) {
     std::swap(borrowable_, that.borrowable_);
+    std::swap<BorrowDiagnostics>(*this, that);
   }
 
   ~borrowed_callable() {
     if (borrowable_ != nullptr) {
-      borrowable_->Relinquish();
+      borrowable_->Relinquish(diagnostics());
     }
   }
 
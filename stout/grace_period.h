@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "glog/logging.h"
+#include "stout/atomic-backoff.h"
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// Lets threads enter and exit read-side critical sections while only
+// writing to their own (thread-local) state, and lets another thread
+// wait for a "grace period", i.e., until every thread that was in a
+// read-side critical section when it started waiting has exited it.
+//
+// Each thread gets a 'Reader' which is registered in a global
+// lock-free list the first time the thread enters a critical
+// section. A 'Reader' gets reused by another thread after its thread
+// exits so the list only grows as large as the maximum number of
+// threads that have concurrently entered critical sections.
+//
+// Every 'Domain' (any type, it's only used as a tag) has its own list
+// of readers, so waiting for a grace period in one domain never waits
+// for critical sections of another domain, e.g., 'BorrowableMap' has
+// its own domain so erasing doesn't wait for (or conflict with) any
+// 'borrowed_read_ref'.
+//
+// NOTE: critical sections may be nested but waiting for a grace
+// period from within a critical section (of the same domain) would
+// wait forever and is therefore an error.
+template <typename Domain>
+class GracePeriodDomain final {
+ public:
+  static void Enter() {
+    Reader& reader = Local();
+    if (reader.nesting++ == 0) {
+      // NOTE: this must be sequentially consistent so that any
+      // subsequent loads (e.g., checking whether or not it's still
+      // safe to read something) can't be reordered before it.
+      reader.sequence.store(reader.sequence.load() + 1);
+    }
+  }
+
+  static void Exit() {
+    Reader& reader = Local();
+    CHECK_GT(reader.nesting, 0u);
+    if (--reader.nesting == 0) {
+      reader.sequence.store(
+          reader.sequence.load() + 1,
+          std::memory_order_release);
+    }
+  }
+
+  static void Wait() {
+    Reader* local = LocalRegistration().reader;
+    if (local != nullptr) {
+      CHECK_EQ(local->nesting, 0u)
+          << "Waiting for a grace period from within a critical section";
+    }
+
+    for (Reader* reader = readers().load();
+         reader != nullptr;
+         reader = reader->next) {
+      // An odd sequence means the reader is in a critical section,
+      // in which case we wait until it has exited (or exited and
+      // entered again, which can only be after we started waiting).
+      uint64_t sequence = reader->sequence.load();
+      if (sequence % 2 == 1) {
+        AtomicBackoff backoff;
+        while (reader->sequence.load() == sequence) {
+          backoff.pause();
+        }
+      }
+    }
+  }
+
+ private:
+  struct alignas(64) Reader {
+    std::atomic<uint64_t> sequence = 0;
+    std::atomic<bool> registered = true;
+    Reader* next = nullptr;
+
+    // Only ever accessed by the thread that has registered.
+    size_t nesting = 0;
+  };
+
+  struct Registration {
+    ~Registration() {
+      if (reader != nullptr) {
+        reader->registered.store(false);
+      }
+    }
+
+    Reader* reader = nullptr;
+  };
+
+  static std::atomic<Reader*>& readers() {
+    static std::atomic<Reader*> readers(nullptr);
+    return readers;
+  }
+
+  static Registration& LocalRegistration() {
+    static thread_local Registration registration;
+    return registration;
+  }
+
+  static Reader& Local() {
+    auto& registration = LocalRegistration();
+
+    if (registration.reader == nullptr) {
+      // Try and reuse a reader from a thread that has exited.
+      for (Reader* reader = readers().load();
+           reader != nullptr;
+           reader = reader->next) {
+        bool registered = false;
+        if (!reader->registered.load()
+            && reader->registered.compare_exchange_strong(registered, true)) {
+          registration.reader = reader;
+          return *reader;
+        }
+      }
+
+      // NOTE: readers are never deallocated since a thread waiting
+      // for a grace period might be iterating through them.
+      Reader* reader = new Reader();
+      reader->next = readers().load();
+      while (!readers().compare_exchange_weak(reader->next, reader)) {}
+
+      registration.reader = reader;
+    }
+
+    return *registration.reader;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+// The default domain, used for read borrows, see 'borrowed_read_ref'.
+using GracePeriod = GracePeriodDomain<void>;
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "glog/logging.h"
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// A move-only type-erased 'void()' callable that stores the callable
+// inline, i.e., unlike 'std::function' it never allocates. Attempting
+// to store a callable larger than 'kCapacity' is a compile-time
+// error. If a larger callable really is necessary you can explicitly
+// wrap it in something that fits, e.g., a 'std::function' or a
+// lambda that captures a 'std::unique_ptr' to the callable.
+template <size_t kCapacity>
+class InlineCallback final {
+ public:
+  InlineCallback() {}
+
+  template <
+      typename F,
+      std::enable_if_t<
+          !std::is_same_v<std::decay_t<F>, InlineCallback>,
+          int> = 0>
+  InlineCallback(F&& f) {
+    using G = std::decay_t<F>;
+
+    static_assert(
+        sizeof(G) <= kCapacity,
+        "Callable is too big to be stored inline, either capture less, "
+        "explicitly wrap it in something that fits (e.g., a "
+        "'std::function'), or increase the capacity");
+
+    static_assert(
+        alignof(G) <= alignof(std::max_align_t),
+        "Callable is over-aligned and can't be stored inline");
+
+    static_assert(
+        std::is_nothrow_move_constructible_v<G>,
+        "Callable must be nothrow move constructible");
+
+    new (&storage_) G(std::forward<F>(f));
+
+    operations_ = &kOperations<G>;
+  }
+
+  InlineCallback(const InlineCallback& that) = delete;
+
+  InlineCallback(InlineCallback&& that) {
+    if (that.operations_ != nullptr) {
+      that.operations_->move(&that.storage_, &storage_);
+      std::swap(operations_, that.operations_);
+    }
+  }
+
+  ~InlineCallback() {
+    reset();
+  }
+
+  InlineCallback& operator=(InlineCallback&& that) {
+    if (this != &that) {
+      reset();
+      if (that.operations_ != nullptr) {
+        that.operations_->move(&that.storage_, &storage_);
+        std::swap(operations_, that.operations_);
+      }
+    }
+    return *this;
+  }
+
+  explicit operator bool() const {
+    return operations_ != nullptr;
+  }
+
+  void operator()() {
+    CHECK_NOTNULL(operations_)->invoke(&storage_);
+  }
+
+  void reset() {
+    if (operations_ != nullptr) {
+      operations_->destroy(&storage_);
+      operations_ = nullptr;
+    }
+  }
+
+ private:
+  struct Operations {
+    void (*invoke)(void*);
+
+    // Moves from the first argument into the (uninitialized) second
+    // argument and then destructs the first argument.
+    void (*move)(void*, void*);
+
+    void (*destroy)(void*);
+  };
+
+  template <typename G>
+  static constexpr Operations kOperations = {
+      [](void* g) {
+        (*static_cast<G*>(g))();
+      },
+      [](void* from, void* to) {
+        new (to) G(std::move(*static_cast<G*>(from)));
+        static_cast<G*>(from)->~G();
+      },
+      [](void* g) {
+        static_cast<G*>(g)->~G();
+      },
+  };
+
+  alignas(std::max_align_t) unsigned char storage_[kCapacity];
+
+  const Operations* operations_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#include "glog/logging.h"
+#include "stout/borrowed_ptr.h"
+#include "stout/thread_pool.h"
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// Invokes 'task(i, borrowed)' for each 'i' in '[0, n)' on 'pool'
+// where each task gets its own 'borrowed_ptr' of 'borrowable' (all
+// of which get borrowed with a single atomic operation), and then
+// invokes 'done()' once every task has relinquished its borrow
+// without blocking the caller, e.g.:
+//
+//   Scatter(
+//       buffer,
+//       chunks,
+//       [](size_t i, borrowed_ptr<Buffer> buffer) {
+//         // Process chunk 'i' of 'buffer' ...
+//       },
+//       pool,
+//       []() {
+//         // All chunks have been processed!
+//       });
+//
+// Each task gets its own copy of 'task' and may hold on to its borrow
+// for as long as it likes (e.g., for some asynchronous continuation)
+// since it's relinquishing the borrows, not returning from 'task',
+// that completes the scatter.
+//
+// NOTE: 'done' gets invoked via 'Watch()' which means it must fit
+// inline (see 'STOUT_BORROWABLE_WATCH_CAPACITY'), the borrowable must
+// not already be watched, and 'done' won't get invoked until *every*
+// borrow (not just those from this scatter) has been relinquished.
+// It's also an error to borrow (rather than reborrow) 'borrowable'
+// until 'done' has been invoked. 'SingleThreaded' borrowables can't
+// be scattered.
+template <typename B, typename Task, typename Done>
+void Scatter(
+    B& borrowable,
+    size_t n,
+    Task&& task,
+    ThreadPool& pool,
+    Done&& done) {
+  auto borrows = borrowable.Borrow(n);
+
+  // NOTE: we watch before submitting any tasks since the watch
+  // callback might otherwise get invoked before we've watched.
+  CHECK(borrowable.Watch(std::forward<Done>(done)))
+      << "Can't scatter a borrowable that is already being watched";
+
+  for (size_t i = 0; i < n; i++) {
+    pool.Submit(
+        [i, task, borrowed = borrows.take()]() mutable {
+          task(i, std::move(borrowed));
+        });
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
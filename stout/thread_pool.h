@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "glog/logging.h"
+
+////////////////////////////////////////////////////////////////////////
+
+namespace stout {
+
+////////////////////////////////////////////////////////////////////////
+
+// A simple work-stealing thread pool, e.g., for 'Scatter()'.
+//
+// Each worker has its own queue of tasks. A task submitted from a
+// worker goes onto that worker's queue (and gets run by it in LIFO
+// order for locality) while tasks submitted from any other thread
+// get distributed round-robin. A worker that runs out of tasks steals
+// the oldest task from another worker's queue before going to sleep,
+// and submitting only has to wake a worker up if one is sleeping.
+//
+// NOTE: unlike 'std::function' tasks may be move-only, e.g., they
+// may capture a 'borrowed_ptr'. Destructing a pool waits for every
+// submitted task to finish (including tasks submitted while
+// destructing) and is therefore an error from within a task.
+class ThreadPool final {
+ public:
+  explicit ThreadPool(
+      size_t threads = std::max(std::thread::hardware_concurrency(), 1u)) {
+    CHECK_GT(threads, 0u);
+
+    for (size_t i = 0; i < threads; i++) {
+      workers_.push_back(std::make_unique<Worker>());
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+      threads_.emplace_back([this, i]() {
+        Run(i);
+      });
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool(ThreadPool&&) = delete;
+
+  ~ThreadPool() {
+    CHECK(local().pool != this)
+        << "Destructing a thread pool from one of its own tasks";
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+
+    condition_.notify_all();
+
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ThreadPool& operator=(ThreadPool&&) = delete;
+
+  size_t size() const {
+    return workers_.size();
+  }
+
+  template <typename F>
+  void Submit(F&& f) {
+    Task task(std::forward<F>(f));
+
+    Local& local = this->local();
+
+    size_t i = local.pool == this
+        ? local.worker
+        : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+
+    // NOTE: incrementing 'pending_' before checking 'sleeping_' (and
+    // workers incrementing 'sleeping_' before checking 'pending_')
+    // ensures that a worker can't go to sleep without seeing this
+    // task. Incrementing before queueing ensures that 'pending_'
+    // never underflows when a worker takes the task right away.
+    pending_.fetch_add(1);
+
+    {
+      Worker& worker = *workers_[i];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      worker.tasks.push_back(std::move(task));
+    }
+
+    if (sleeping_.load() > 0) {
+      // Acquire the lock so that we don't notify between a worker
+      // checking 'pending_' and actually waiting.
+      std::lock_guard<std::mutex> lock(mutex_);
+      condition_.notify_one();
+    }
+  }
+
+ private:
+  // A move-only 'void()' callable.
+  class Task final {
+   public:
+    Task() {}
+
+    template <
+        typename F,
+        std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>, int> = 0>
+    Task(F&& f)
+      : callable_(new Callable<std::decay_t<F>>(std::forward<F>(f))) {}
+
+    void operator()() {
+      (*callable_)();
+    }
+
+   private:
+    struct Base {
+      virtual ~Base() = default;
+      virtual void operator()() = 0;
+    };
+
+    template <typename F>
+    struct Callable final : Base {
+      explicit Callable(F&& f)
+        : f(std::move(f)) {}
+
+      explicit Callable(const F& f)
+        : f(f) {}
+
+      void operator()() override {
+        f();
+      }
+
+      F f;
+    };
+
+    std::unique_ptr<Base> callable_;
+  };
+
+  struct alignas(64) Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Which pool (if any) and worker the calling thread belongs to.
+  struct Local {
+    ThreadPool* pool = nullptr;
+    size_t worker = 0;
+  };
+
+  static Local& local() {
+    static thread_local Local local;
+    return local;
+  }
+
+  void Run(size_t i) {
+    local().pool = this;
+    local().worker = i;
+
+    Task task;
+    while (Take(i, task)) {
+      task();
+
+      // Destruct the task before taking another one, e.g., so that
+      // any borrows it captured get relinquished.
+      task = Task();
+    }
+  }
+
+  // Takes a task from worker 'i' (or steals one from another worker),
+  // sleeping until there is a task to take. Returns false once the
+  // pool is stopping and there aren't any more tasks.
+  bool Take(size_t i, Task& task) {
+    while (true) {
+      if (TryTake(i, task)) {
+        pending_.fetch_sub(1);
+        return true;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      sleeping_.fetch_add(1);
+
+      condition_.wait(lock, [this]() {
+        return pending_.load() > 0 || stopping_;
+      });
+
+      sleeping_.fetch_sub(1);
+
+      if (pending_.load() == 0 && stopping_) {
+        return false;
+      }
+    }
+  }
+
+  bool TryTake(size_t i, Task& task) {
+    {
+      Worker& worker = *workers_[i];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (!worker.tasks.empty()) {
+        task = std::move(worker.tasks.back());
+        worker.tasks.pop_back();
+        return true;
+      }
+    }
+
+    for (size_t j = 1; j < workers_.size(); j++) {
+      Worker& worker = *workers_[(i + j) % workers_.size()];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      if (!worker.tasks.empty()) {
+        task = std::move(worker.tasks.front());
+        worker.tasks.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+  std::atomic<size_t> next_ = 0;
+
+  // Number of tasks that have been submitted but not yet taken.
+  std::atomic<size_t> pending_ = 0;
+  std::atomic<size_t> sleeping_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stopping_ = false;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+} // namespace stout
+
+////////////////////////////////////////////////////////////////////////
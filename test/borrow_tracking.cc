@@ -0,0 +1,156 @@
+#include "stout/borrow_tracking.h"
+
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "stout/borrowed_ptr.h"
+
+using std::string;
+using std::thread;
+
+using stout::Borrowable;
+using stout::BorrowTracking;
+using stout::borrowed_ptr;
+using stout::borrowed_ref;
+
+using testing::HasSubstr;
+using testing::Not;
+
+static string Dump(const void* borrowable, size_t* outstanding = nullptr) {
+  std::ostringstream os;
+  size_t n = BorrowTracking::Dump(borrowable, os);
+  if (outstanding != nullptr) {
+    *outstanding = n;
+  }
+  return os.str();
+}
+
+static string Location(int line) {
+  return string("borrow_tracking.cc:") + std::to_string(line) + " ";
+}
+
+
+TEST(BorrowTrackingTest, Dump) {
+  Borrowable<string> s("hello world");
+
+  size_t outstanding = 0;
+
+  EXPECT_EQ("", Dump(&s, &outstanding));
+  EXPECT_EQ(0u, outstanding);
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+  int borrowed_line = __LINE__ - 1;
+
+  {
+    borrowed_ptr<string> reborrowed = borrowed.reborrow();
+    int reborrowed_line = __LINE__ - 1;
+
+    string dump = Dump(&s, &outstanding);
+
+    EXPECT_EQ(2u, outstanding);
+    EXPECT_THAT(dump, HasSubstr(Location(borrowed_line)));
+    EXPECT_THAT(dump, HasSubstr(Location(reborrowed_line)));
+  }
+
+  string dump = Dump(&s, &outstanding);
+
+  EXPECT_EQ(1u, outstanding);
+  EXPECT_THAT(dump, HasSubstr(Location(borrowed_line)));
+
+  // Moving (and converting an rvalue) keeps the original location.
+  borrowed_ptr<const string> moved = std::move(borrowed);
+
+  EXPECT_THAT(Dump(&s, &outstanding), HasSubstr(Location(borrowed_line)));
+  EXPECT_EQ(1u, outstanding);
+
+  moved.relinquish();
+
+  EXPECT_EQ("", Dump(&s, &outstanding));
+  EXPECT_EQ(0u, outstanding);
+}
+
+
+TEST(BorrowTrackingTest, RelinquishOnDifferentThread) {
+  Borrowable<string> s("hello world");
+
+  borrowed_ptr<string> borrowed;
+
+  thread([&]() {
+    borrowed = s.Borrow();
+  }).join();
+
+  size_t outstanding = 0;
+
+  Dump(&s, &outstanding);
+  EXPECT_EQ(1u, outstanding);
+
+  borrowed.relinquish();
+
+  Dump(&s, &outstanding);
+  EXPECT_EQ(0u, outstanding);
+
+  // Released records get reused.
+  for (size_t i = 0; i < 100; i++) {
+    borrowed_ref<string> borrowed = s.Borrow();
+  }
+
+  Dump(&s, &outstanding);
+  EXPECT_EQ(0u, outstanding);
+}
+
+
+TEST(BorrowTrackingTest, StalledDestructor) {
+  static std::mutex mutex;
+  static const void* stalled = nullptr;
+  static string report;
+
+  auto deadline = BorrowTracking::deadline();
+  auto reporter = BorrowTracking::reporter();
+
+  BorrowTracking::deadline(std::chrono::milliseconds(1));
+  BorrowTracking::reporter(+[](const void* borrowable, const string& s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stalled = borrowable;
+    report = s;
+  });
+
+  auto* s = new Borrowable<string>("hello world");
+
+  borrowed_ptr<string> borrowed = s->Borrow();
+  int line = __LINE__ - 1;
+
+  thread t([&]() {
+    delete s;
+  });
+
+  // Wait until the destructor has been waiting for longer than the
+  // deadline, at which point it reports the outstanding borrows (and
+  // keeps waiting).
+  auto reported = [&]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stalled != nullptr;
+  };
+
+  while (!reported()) {
+    std::this_thread::yield();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(s, stalled);
+    EXPECT_THAT(report, HasSubstr("1 borrow(s) to be relinquished"));
+    EXPECT_THAT(report, HasSubstr(Location(line)));
+  }
+
+  borrowed.relinquish();
+
+  t.join();
+
+  BorrowTracking::deadline(deadline);
+  BorrowTracking::reporter(reporter);
+}
@@ -0,0 +1,225 @@
+#include "stout/borrowable_map.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "stout/borrowable.h"
+
+using std::atomic;
+using std::string;
+using std::thread;
+using std::vector;
+
+using stout::Borrowable;
+using stout::BorrowableMap;
+using stout::borrowed_ptr;
+
+struct Counted {
+  Counted(atomic<int>& live)
+    : live_(live) {
+    live_++;
+  }
+
+  ~Counted() {
+    live_--;
+  }
+
+  atomic<int>& live_;
+};
+
+
+TEST(BorrowableMapTest, InsertLookupErase) {
+  BorrowableMap<int, string> map;
+
+  EXPECT_TRUE(map.Insert(1, "hello"));
+  EXPECT_TRUE(map.Insert(2, "world"));
+
+  // Can't insert the same key twice.
+  EXPECT_FALSE(map.Insert(1, "goodbye"));
+
+  EXPECT_EQ(2u, map.size());
+
+  borrowed_ptr<string> hello = map.Lookup(1);
+
+  ASSERT_TRUE(hello);
+  EXPECT_EQ("hello", *hello);
+  EXPECT_EQ("world", *map.Lookup(2));
+  EXPECT_FALSE(map.Lookup(3));
+
+  EXPECT_TRUE(map.Erase(1));
+  EXPECT_FALSE(map.Erase(1));
+
+  EXPECT_EQ(1u, map.size());
+  EXPECT_FALSE(map.Lookup(1));
+
+  // Still borrowed after being erased.
+  EXPECT_EQ("hello", *hello);
+
+  // And can be inserted again.
+  EXPECT_TRUE(map.Insert(1, "goodbye"));
+  EXPECT_EQ("goodbye", *map.Lookup(1));
+}
+
+
+TEST(BorrowableMapTest, DestructOnLastRelinquish) {
+  atomic<int> live(0);
+
+  BorrowableMap<int, Counted> map;
+
+  map.Insert(1, live);
+  map.Insert(2, live);
+
+  EXPECT_EQ(2, live.load());
+
+  borrowed_ptr<Counted> borrowed = map.Lookup(1);
+
+  // Erasing doesn't wait for the borrow.
+  EXPECT_TRUE(map.Erase(1));
+
+  EXPECT_EQ(2, live.load());
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(1, live.load());
+
+  // Not borrowed so destructed right away.
+  EXPECT_TRUE(map.Erase(2));
+
+  EXPECT_EQ(0, live.load());
+}
+
+
+TEST(BorrowableMapTest, DestructWhileBorrowed) {
+  atomic<int> live(0);
+
+  borrowed_ptr<Counted> borrowed;
+
+  {
+    BorrowableMap<int, Counted> map;
+
+    map.Insert(1, live);
+    map.Insert(2, live);
+
+    borrowed = map.Lookup(2);
+  }
+
+  EXPECT_EQ(1, live.load());
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(0, live.load());
+}
+
+
+TEST(BorrowableMapTest, Collisions) {
+  struct Colliding {
+    size_t operator()(int) const {
+      return 42;
+    }
+  };
+
+  BorrowableMap<int, int, Colliding> map;
+
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(map.Insert(i, i));
+  }
+
+  EXPECT_TRUE(map.Erase(5));
+  EXPECT_TRUE(map.Erase(0));
+  EXPECT_TRUE(map.Erase(9));
+
+  for (int i = 0; i < 10; i++) {
+    if (i == 0 || i == 5 || i == 9) {
+      EXPECT_FALSE(map.Lookup(i));
+    } else {
+      EXPECT_EQ(i, *map.Lookup(i));
+    }
+  }
+}
+
+
+TEST(BorrowableMapTest, LookupWhileErasing) {
+  atomic<int> live(0);
+
+  BorrowableMap<int, Counted> map(16);
+
+  constexpr int kKeys = 64;
+
+  atomic<bool> stop = false;
+
+  vector<thread> threads;
+
+  for (size_t i = 0; i < 4; i++) {
+    threads.emplace_back([&]() {
+      int key = 0;
+      while (!stop.load()) {
+        borrowed_ptr<Counted> borrowed = map.Lookup(key++ % kKeys);
+        if (borrowed) {
+          EXPECT_GT(borrowed->live_.load(), 0);
+        }
+      }
+    });
+  }
+
+  for (size_t round = 0; round < 100; round++) {
+    for (int key = 0; key < kKeys; key++) {
+      map.Insert(key, live);
+    }
+    for (int key = 0; key < kKeys; key++) {
+      EXPECT_TRUE(map.Erase(key));
+    }
+  }
+
+  stop.store(true);
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(0, live.load());
+  EXPECT_EQ(0u, map.size());
+}
+
+
+TEST(BorrowableMapTest, EraseWhileReadBorrowed) {
+  BorrowableMap<int, string> map;
+
+  Borrowable<string> s("hello world");
+
+  map.Insert(1, "hello");
+  map.Insert(2, "world");
+
+  atomic<bool> reading(false);
+  atomic<bool> erased(false);
+
+  // Erasing doesn't wait for an unrelated read borrow held by
+  // another thread ...
+  thread t([&]() {
+    auto read = s.Read();
+    reading.store(true);
+    while (!erased.load()) {
+      std::this_thread::yield();
+    }
+  });
+
+  while (!reading.load()) {
+    std::this_thread::yield();
+  }
+
+  EXPECT_TRUE(map.Erase(1));
+
+  erased.store(true);
+
+  t.join();
+
+  // ... nor is it an error to erase while holding a read borrow.
+  {
+    auto read = s.Read();
+    EXPECT_TRUE(map.Erase(2));
+  }
+
+  EXPECT_EQ(0u, map.size());
+}
@@ -0,0 +1,137 @@
+#include "stout/borrowable_owner.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+using std::atomic;
+using std::string;
+using std::thread;
+
+using stout::borrowable_owner;
+using stout::borrowed_ptr;
+using stout::make_borrowable_owner;
+
+struct Destructed {
+  Destructed(atomic<bool>& destructed)
+    : destructed_(destructed) {}
+
+  ~Destructed() {
+    destructed_.store(true);
+  }
+
+  atomic<bool>& destructed_;
+};
+
+
+TEST(BorrowableOwnerTest, ResetWithoutBorrows) {
+  atomic<bool> destructed(false);
+
+  auto owner = make_borrowable_owner<Destructed>(destructed);
+
+  EXPECT_TRUE(owner);
+
+  owner.reset();
+
+  EXPECT_FALSE(owner);
+  EXPECT_TRUE(destructed.load());
+}
+
+
+TEST(BorrowableOwnerTest, LastRelinquishDestructs) {
+  atomic<bool> destructed(false);
+
+  auto owner = make_borrowable_owner<Destructed>(destructed);
+
+  borrowed_ptr<Destructed> borrowed = owner.Borrow();
+  borrowed_ptr<Destructed> reborrowed = borrowed.reborrow();
+
+  EXPECT_EQ(owner.borrows(), 2);
+
+  // Doesn't wait for the borrows to be relinquished.
+  owner.reset();
+
+  EXPECT_FALSE(destructed.load());
+
+  borrowed.relinquish();
+
+  EXPECT_FALSE(destructed.load());
+
+  // Reborrowing is still possible as long as there is a borrow.
+  borrowed = reborrowed.reborrow();
+
+  reborrowed.relinquish();
+
+  EXPECT_FALSE(destructed.load());
+
+  thread([borrowed = std::move(borrowed)]() {}).join();
+
+  EXPECT_TRUE(destructed.load());
+}
+
+
+TEST(BorrowableOwnerTest, Sharded) {
+  atomic<bool> destructed(false);
+
+  auto owner = make_borrowable_owner<Destructed, stout::Sharded>(destructed);
+
+  auto borrows = owner.Borrow(4);
+
+  owner = borrowable_owner<Destructed, stout::Sharded>();
+
+  EXPECT_FALSE(destructed.load());
+
+  borrows.relinquish();
+
+  EXPECT_TRUE(destructed.load());
+}
+
+
+TEST(BorrowableOwnerTest, ResetWhileDraining) {
+  atomic<bool> destructed(false);
+  atomic<bool> drained(false);
+
+  auto owner = make_borrowable_owner<Destructed>(destructed);
+
+  borrowed_ptr<Destructed> borrowed = owner.Borrow();
+
+  EXPECT_TRUE(owner.Drain([&]() {
+    // Still invoked before destructing.
+    EXPECT_FALSE(destructed.load());
+    drained.store(true);
+  }));
+
+  owner.reset();
+
+  EXPECT_FALSE(drained.load());
+  EXPECT_FALSE(destructed.load());
+
+  borrowed.relinquish();
+
+  EXPECT_TRUE(drained.load());
+  EXPECT_TRUE(destructed.load());
+}
+
+
+TEST(BorrowableOwnerTest, ResetAfterDrained) {
+  atomic<bool> destructed(false);
+  atomic<bool> drained(false);
+
+  auto owner = make_borrowable_owner<Destructed>(destructed);
+
+  {
+    auto borrowed = owner.Borrow();
+  }
+
+  EXPECT_TRUE(owner.Drain([&]() {
+    drained.store(true);
+  }));
+
+  EXPECT_TRUE(drained.load());
+
+  owner.reset();
+
+  EXPECT_TRUE(destructed.load());
+}
@@ -0,0 +1,181 @@
+#include "stout/borrowable_pool.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::atomic;
+using std::string;
+using std::thread;
+using std::vector;
+
+using stout::BorrowablePool;
+using stout::borrowed_ptr;
+using stout::borrowed_ref;
+
+struct Counted {
+  Counted(atomic<int>& live)
+    : live_(live) {
+    live_++;
+  }
+
+  ~Counted() {
+    live_--;
+  }
+
+  atomic<int>& live_;
+};
+
+
+TEST(BorrowablePoolTest, Make) {
+  BorrowablePool<string> pool;
+
+  borrowed_ref<string> s = pool.Make("hello world");
+
+  EXPECT_EQ("hello world", *s);
+
+  borrowed_ref<string> reborrowed = s.reborrow();
+
+  EXPECT_EQ("hello world", *reborrowed);
+}
+
+
+TEST(BorrowablePoolTest, DestructOnLastRelinquish) {
+  atomic<int> live(0);
+
+  BorrowablePool<Counted> pool;
+
+  borrowed_ptr<Counted> counted = pool.Make(live);
+
+  EXPECT_EQ(1, live.load());
+
+  borrowed_ptr<Counted> reborrowed = counted.reborrow();
+
+  counted.relinquish();
+
+  EXPECT_EQ(1, live.load());
+
+  reborrowed.relinquish();
+
+  EXPECT_EQ(0, live.load());
+}
+
+
+TEST(BorrowablePoolTest, RecycleSlots) {
+  BorrowablePool<string> pool;
+
+  const string* first = nullptr;
+
+  {
+    borrowed_ref<string> s = pool.Make("hello world");
+    first = &*s;
+  }
+
+  // The most recently recycled slot gets used first.
+  borrowed_ref<string> s = pool.Make("goodbye");
+
+  EXPECT_EQ(first, &*s);
+  EXPECT_EQ("goodbye", *s);
+}
+
+
+TEST(BorrowablePoolTest, RelinquishOnDifferentThreads) {
+  atomic<int> live(0);
+
+  BorrowablePool<Counted> pool;
+
+  // Make more than a thread keeps so that slots get handed over to
+  // the shared free list and then taken again.
+  constexpr size_t kBorrows = 4 * BorrowablePool<Counted>::kMaxFreeSlots;
+
+  for (size_t round = 0; round < 2; round++) {
+    vector<borrowed_ptr<Counted>> borrows;
+
+    for (size_t i = 0; i < kBorrows; i++) {
+      borrows.push_back(pool.Make(live));
+    }
+
+    EXPECT_EQ(static_cast<int>(kBorrows), live.load());
+
+    vector<thread> threads;
+
+    for (size_t i = 0; i < 4; i++) {
+      threads.emplace_back([&, i]() {
+        for (size_t j = i; j < kBorrows; j += 4) {
+          borrows[j].relinquish();
+        }
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    EXPECT_EQ(0, live.load());
+  }
+}
+
+
+TEST(BorrowablePoolTest, ThreadChurn) {
+  BorrowablePool<string> pool;
+
+  // Every thread's free slots get handed over when it exits (and its
+  // cache gets used again) so short-lived threads don't need any new
+  // slots.
+  for (size_t i = 0; i < 100; i++) {
+    thread([&]() {
+      borrowed_ref<string> s = pool.Make("hello world");
+    }).join();
+  }
+
+  EXPECT_EQ(BorrowablePool<string>::kSlabSlots, pool.capacity());
+
+  // Including slots that were made on one thread but recycled on
+  // another that has since exited.
+  for (size_t i = 0; i < 100; i++) {
+    borrowed_ptr<string> s = pool.Make("hello world");
+    thread([s = std::move(s)]() {}).join();
+  }
+
+  EXPECT_EQ(BorrowablePool<string>::kSlabSlots, pool.capacity());
+}
+
+
+TEST(BorrowablePoolTest, AlternatePools) {
+  BorrowablePool<string> pool1;
+  BorrowablePool<string> pool2;
+
+  for (size_t i = 0; i < 100; i++) {
+    borrowed_ref<string> s1 = pool1.Make("hello");
+    borrowed_ref<string> s2 = pool2.Make("world");
+  }
+
+  EXPECT_EQ(BorrowablePool<string>::kSlabSlots, pool1.capacity());
+  EXPECT_EQ(BorrowablePool<string>::kSlabSlots, pool2.capacity());
+
+  // Threads can outlive a pool they've used.
+  std::unique_ptr<BorrowablePool<string>> pool3(
+      new BorrowablePool<string>());
+
+  thread t([&]() {
+    { borrowed_ref<string> s = pool3->Make("goodbye"); }
+    pool3.reset();
+  });
+
+  t.join();
+}
+
+
+TEST(BorrowablePoolTest, DestructWithOutstandingBorrows) {
+  auto destruct = []() {
+    auto* pool = new BorrowablePool<string>();
+    borrowed_ref<string> s = pool->Make("hello world");
+    delete pool;
+  };
+
+  EXPECT_DEATH(destruct(), "Destructing a pool with outstanding borrows");
+}
@@ -0,0 +1,116 @@
+#include "stout/borrowable_stats.h"
+
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "stout/borrowed_ptr.h"
+
+using std::string;
+using std::thread;
+
+using stout::Borrowable;
+using stout::BorrowableStats;
+using stout::borrowed_ptr;
+
+using testing::HasSubstr;
+using testing::Not;
+
+static string Dump() {
+  std::ostringstream os;
+  BorrowableStats::Dump(os);
+  return os.str();
+}
+
+
+TEST(BorrowableStatsTest, Dump) {
+  Borrowable<string> s("hello world");
+
+  std::ostringstream address;
+  address << static_cast<const void*>(&s);
+
+  {
+    borrowed_ptr<string> borrowed = s.Borrow();
+    borrowed_ptr<string> reborrowed = borrowed.reborrow();
+
+    auto borrows = s.Borrow(3);
+  }
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  string dump = Dump();
+
+  EXPECT_THAT(dump, HasSubstr(address.str()));
+  EXPECT_THAT(dump, HasSubstr(" borrowing=1 borrows=6 peak=5 "));
+
+  EXPECT_THAT(dump, HasSubstr(" lifetimes_log2_ns=["));
+  EXPECT_THAT(dump, Not(HasSubstr(" lifetimes_log2_ns=[]")));
+  EXPECT_THAT(dump, Not(HasSubstr(" waiting_ns=")));
+}
+
+
+TEST(BorrowableStatsTest, Unregister) {
+  std::ostringstream address;
+
+  {
+    Borrowable<string> s("hello world");
+    address << static_cast<const void*>(&s);
+    EXPECT_THAT(Dump(), HasSubstr(address.str()));
+  }
+
+  EXPECT_THAT(Dump(), Not(HasSubstr(address.str())));
+}
+
+
+TEST(BorrowableStatsTest, Waiting) {
+  thread t;
+
+  std::atomic<bool> dumped(false);
+
+  {
+    Borrowable<string> s("hello world");
+
+    borrowed_ptr<string> borrowed = s.Borrow();
+
+    t = thread([&dumped, borrowed = std::move(borrowed)]() mutable {
+      // Wait until the destructor has started waiting.
+      while (Dump().find(" waiting_ns=") == string::npos) {}
+      dumped.store(true);
+    });
+  }
+
+  EXPECT_TRUE(dumped.load());
+
+  t.join();
+
+  EXPECT_THAT(Dump(), Not(HasSubstr(" waiting_ns=")));
+}
+
+
+TEST(BorrowableStatsTest, DestructWithSlowBorrower) {
+  thread t;
+
+  std::atomic<bool> parked(false);
+
+  {
+    Borrowable<string> s("hello world");
+
+    borrowed_ptr<string> borrowed = s.Borrow();
+
+    t = thread([&parked, borrowed = std::move(borrowed)]() mutable {
+      // Don't relinquish until the destructor has stopped spinning
+      // and parked, rather than hoping a sleep is long enough.
+      while (Dump().find(" parks=1") == string::npos) {
+        std::this_thread::yield();
+      }
+      parked.store(true);
+      borrowed.relinquish();
+    });
+  }
+
+  EXPECT_TRUE(parked.load());
+
+  t.join();
+}
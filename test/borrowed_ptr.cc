@@ -1,6 +1,8 @@
 #include "stout/borrowed_ptr.h"
 
 #include <atomic>
+#include <chrono>
+#include <future>
 #include <string>
 #include <thread>
 #include <vector>
@@ -8,6 +10,7 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "stout/borrowable.h"
+#include "stout/thread_pool.h"
 
 using std::atomic;
 using std::function;
@@ -17,13 +20,29 @@ using std::unique_ptr;
 using std::vector;
 
 using stout::Borrowable;
+using stout::DeferRelinquish;
+using stout::borrowed_compact_ptr;
+using stout::borrowed_exclusive_ptr;
 using stout::borrowed_ptr;
 using stout::borrowed_ref;
+using stout::borrowed_span;
+using stout::borrowed_weak;
 using stout::enable_borrowable_from_this;
+using stout::ThreadPool;
 
 using testing::_;
 using testing::MockFunction;
 
+// Statistics and tracking must not take up any space unless they've
+// been enabled, see 'STOUT_BORROWABLE_STATS' and
+// 'STOUT_BORROWABLE_TRACKING'.
+#if !defined(STOUT_BORROWABLE_STATS) && !defined(STOUT_BORROWABLE_TRACKING)
+static_assert(sizeof(borrowed_ref<int>) == 2 * sizeof(void*));
+static_assert(sizeof(borrowed_ptr<int>) == 2 * sizeof(void*));
+static_assert(sizeof(borrowed_compact_ptr<int>) == sizeof(void*));
+#endif
+
+
 TEST(BorrowTest, BorrowRef) {
   Borrowable<string> s("hello world");
 
@@ -98,6 +117,167 @@ TEST(BorrowTest, Reborrow) {
 }
 
 
+TEST(BorrowTest, WatchMoveOnly) {
+  Borrowable<string> s("hello world");
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  auto i = std::make_unique<int>(42);
+
+  int watched = 0;
+
+  // NOTE: callbacks don't need to be copyable (unlike with
+  // 'std::function') since they are stored inline.
+  s.Watch([&watched, i = std::move(i)]() {
+    watched = *i;
+  });
+
+  EXPECT_EQ(watched, 0);
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(watched, 42);
+}
+
+
+// Executor that queues submitted callbacks until 'RunAll()'.
+struct ManualExecutor {
+  template <typename F>
+  void Submit(F&& f) {
+    tasks.emplace_back(std::forward<F>(f));
+  }
+
+  void RunAll() {
+    for (auto& task : std::exchange(tasks, {})) {
+      task();
+    }
+  }
+
+  vector<std::packaged_task<void()>> tasks;
+};
+
+
+TEST(BorrowTest, WatchExecutor) {
+  Borrowable<string> s("hello world");
+
+  ManualExecutor executor;
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(0);
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  EXPECT_TRUE(s.Watch(executor, mock.AsStdFunction()));
+
+  // Relinquishing the last borrow only submits the callback.
+  borrowed.relinquish();
+
+  EXPECT_EQ(executor.tasks.size(), 1);
+
+  // Not watching anymore even though the callback hasn't run yet.
+  EXPECT_TRUE(s.Watch(executor, []() {}));
+
+  EXPECT_EQ(executor.tasks.size(), 2);
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  executor.RunAll();
+}
+
+
+TEST(BorrowTest, WatchThreadPool) {
+  ThreadPool pool(1);
+
+  std::promise<std::thread::id> promise;
+
+  {
+    Borrowable<string> s("hello world");
+
+    borrowed_ptr<string> borrowed = s.Borrow();
+
+    s.Watch(pool, [&promise]() {
+      promise.set_value(std::this_thread::get_id());
+    });
+
+    borrowed.relinquish();
+  }
+
+  EXPECT_NE(promise.get_future().get(), std::this_thread::get_id());
+}
+
+
+TEST(BorrowTest, DefaultExecutor) {
+  ManualExecutor executor;
+
+  Borrowable<string> s("hello world");
+
+  s.SetDefaultExecutor(executor);
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(0);
+
+  // Even watching without any borrows submits rather than invokes.
+  EXPECT_TRUE(s.Watch(mock.AsStdFunction()));
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  EXPECT_TRUE(s.Drain(mock.AsStdFunction()));
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(executor.tasks.size(), 2);
+
+  EXPECT_CALL(mock, Call())
+      .Times(2);
+
+  executor.RunAll();
+}
+
+
+TEST(BorrowTest, WatchInlineAfterExecutor) {
+  Borrowable<string> s("hello world");
+
+  ManualExecutor executor;
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  EXPECT_TRUE(s.Watch(executor, []() {}));
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(executor.tasks.size(), 1);
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  borrowed = s.Borrow();
+
+  // Without an executor the relinquishing thread invokes the
+  // callback again.
+  EXPECT_TRUE(s.Watch(mock.AsStdFunction()));
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(executor.tasks.size(), 1);
+
+  executor.RunAll();
+}
+
+
+TEST(BorrowTest, Size) {
+  // Limits, drain callbacks and executors only get allocated when
+  // used so they don't take up space in every borrowable.
+  EXPECT_LE(sizeof(Borrowable<int>), 128u);
+}
+
+
 TEST(BorrowTest, Emplace) {
   struct S {
     S(borrowed_ptr<int> i)
@@ -206,208 +386,1744 @@ TEST(BorrowTest, MultipleConstBorrows) {
 }
 
 
-TEST(BorrowTest, BorrowedPtrUpcast) {
-  struct Base {
-    int i = 42;
-  };
-
-  struct Derived : public Base {};
-
-  Borrowable<Derived> derived;
+TEST(BorrowTest, BiasedBorrowPtr) {
+  Borrowable<string, stout::Biased> s("hello world");
 
   MockFunction<void()> mock;
 
   EXPECT_CALL(mock, Call())
-      .Times(1);
-
-  borrowed_ptr<Base> base = derived.Borrow();
-
-  base->i++;
+      .Times(0);
 
-  EXPECT_EQ(43, base->i);
+  borrowed_ptr<string> borrowed = s.Borrow();
 
-  derived.Watch(mock.AsStdFunction());
-}
+  EXPECT_EQ(s.borrows(), 1);
 
+  vector<thread> threads;
 
-TEST(BorrowTest, BorrowedPtrConstUpcast) {
-  struct Base {
-    int i = 42;
-  };
+  atomic<bool> wait(true);
 
-  struct Derived : public Base {};
+  for (size_t i = 0; i < 4; i++) {
+    // Borrowed on the owning thread but relinquished on another.
+    threads.push_back(thread([&wait, borrowed = borrowed.reborrow()]() {
+      // Reborrowed and relinquished on a non-owning thread.
+      borrowed_ptr<string> reborrowed = borrowed.reborrow();
+      while (wait.load()) {}
+      // ... destructor will invoke borrowed.relinquish().
+    }));
+  }
 
-  Borrowable<Derived> derived;
+  borrowed.relinquish();
 
-  MockFunction<void()> mock;
+  s.Watch(mock.AsStdFunction());
 
   EXPECT_CALL(mock, Call())
       .Times(1);
 
-  borrowed_ptr<const Base> base = derived.Borrow();
+  wait.store(false);
 
-  EXPECT_EQ(42, base->i);
+  for (auto&& thread : threads) {
+    thread.join();
+  }
 
-  derived.Watch(mock.AsStdFunction());
-}
+  EXPECT_EQ(s.borrows(), 0);
 
+  // Owning thread's count should be used again after the watch
+  // callback was invoked.
+  borrowed = s.Borrow();
 
-TEST(BorrowTest, ConstBorrowedPtrUpcast) {
-  struct Base {
-    int i = 42;
-  };
+  EXPECT_EQ(s.borrows(), 1);
+}
 
-  struct Derived : public Base {};
 
-  Borrowable<const Derived> derived;
+TEST(BorrowTest, SingleThreadedBorrowPtr) {
+  Borrowable<string, stout::SingleThreaded> s("hello world");
 
   MockFunction<void()> mock;
 
   EXPECT_CALL(mock, Call())
-      .Times(1);
+      .Times(0);
 
-  borrowed_ptr<const Base> base = derived.Borrow();
+  borrowed_ptr<string> borrowed = s.Borrow();
 
-  EXPECT_EQ(42, base->i);
+  EXPECT_EQ(s.borrows(), 1);
 
-  derived.Watch(mock.AsStdFunction());
-}
+  borrowed_ptr<const string> reborrowed = borrowed.reborrow();
 
+  auto callable = s.Borrow([]() {});
 
-TEST(BorrowTest, MoveBorrowable) {
-  Borrowable<string> s("hello world");
+  auto borrows = s.Borrow(2);
 
-  borrowed_ptr<string> borrowed = s.Borrow();
+  EXPECT_EQ(s.borrows(), 5);
 
-  atomic<bool> moving(false);
+  borrows.relinquish();
+  borrowed.relinquish();
 
-  auto t = thread([&]() {
-    moving.store(true);
-    Borrowable<string> moved = std::move(s);
-    moving.store(false);
-  });
+  s.Watch(mock.AsStdFunction());
 
-  while (!moving.load()) {}
+  EXPECT_EQ(s.borrows(), 2);
 
-  EXPECT_EQ("hello world", *s);
+  reborrowed.relinquish();
 
-  borrowed_ptr<string> reborrowed = borrowed.reborrow();
+  EXPECT_CALL(mock, Call())
+      .Times(1);
 
-  borrowed.relinquish();
+  {
+    auto moved = std::move(callable);
+  }
 
-  EXPECT_TRUE(moving.load());
+  EXPECT_EQ(s.borrows(), 0);
 
-  reborrowed.relinquish();
+  // Should be counting without the tally again after the watch
+  // callback was invoked.
+  borrowed = s.Borrow();
 
-  t.join();
+  EXPECT_EQ(s.borrows(), 1);
+}
 
-  EXPECT_FALSE(moving.load());
 
-  EXPECT_EQ("", *s);
+TEST(BorrowTest, SingleThreadedDestructWhileBorrowed) {
+  using SingleThreadedString = Borrowable<string, stout::SingleThreaded>;
+
+  EXPECT_DEATH(
+      {
+        // Never relinquished.
+        auto* borrowed = new borrowed_ptr<string>();
+        SingleThreadedString s("hello world");
+        *borrowed = s.Borrow();
+      },
+      "would wait forever");
 }
 
 
-TEST(BorrowTest, CallableMove) {
-  Borrowable<std::string> s("hello world");
+TEST(BorrowTest, BorrowBatch) {
+  Borrowable<string> s("hello world");
 
-  auto callable = s.Borrow([&]() {
-    EXPECT_EQ(s.borrows(), 1);
-  });
+  MockFunction<void()> mock;
 
-  EXPECT_EQ(s.borrows(), 1);
+  EXPECT_CALL(mock, Call())
+      .Times(0);
 
-  {
-    auto moved = std::move(callable);
+  auto borrows = s.Borrow(4);
 
-    EXPECT_EQ(s.borrows(), 1);
+  EXPECT_EQ(borrows.size(), 4);
+  EXPECT_EQ(s.borrows(), 4);
 
-    moved();
-  }
+  s.Watch(mock.AsStdFunction());
 
-  EXPECT_EQ(s.borrows(), 0);
-}
+  vector<thread> threads;
 
+  atomic<bool> wait(true);
 
-TEST(BorrowTest, CallableCopy) {
-  Borrowable<std::string> s("hello world");
+  borrowed_ptr<string> borrowed = borrows.take();
 
-  auto callable = s.Borrow([&]() {
-    EXPECT_EQ(s.borrows(), 2);
-  });
+  EXPECT_EQ("hello world", *borrowed);
+  EXPECT_EQ(borrows.size(), 3);
+  EXPECT_EQ(s.borrows(), 4);
 
-  EXPECT_EQ(s.borrows(), 1);
+  for (borrowed_ptr<string> borrowed : std::move(borrows)) {
+    threads.push_back(thread([&wait, borrowed = std::move(borrowed)]() {
+      while (wait.load()) {}
+      // ... destructor will invoke borrowed.relinquish().
+    }));
+  }
 
-  {
-    auto copy = callable;
+  EXPECT_TRUE(borrows.empty());
 
-    EXPECT_EQ(s.borrows(), 2);
+  borrowed.relinquish();
 
-    copy();
-  }
+  EXPECT_CALL(mock, Call())
+      .Times(1);
 
-  EXPECT_EQ(s.borrows(), 1);
+  wait.store(false);
+
+  for (auto&& thread : threads) {
+    thread.join();
+  }
 }
 
 
-TEST(BorrowTest, EnableBorrowableFromThis) {
-  class Foo : public enable_borrowable_from_this<Foo> {
-   public:
-    Foo(int i)
-      : i(i) {}
-    int i = 0;
-  };
+TEST(BorrowTest, BorrowBatchRelinquish) {
+  Borrowable<string, stout::Sharded> s("hello world");
 
-  Foo foo(42);
+  MockFunction<void()> mock;
 
-  EXPECT_EQ(foo.borrows(), 0);
+  EXPECT_CALL(mock, Call())
+      .Times(1);
 
-  borrowed_ptr<Foo> borrowed = foo.Borrow();
+  auto borrows = s.Borrow(64);
 
-  EXPECT_EQ(foo.borrows(), 1);
+  borrowed_ptr<string> borrowed = borrows.take();
 
-  EXPECT_EQ(borrowed->i, 42);
-}
+  EXPECT_EQ(s.borrows(), 64);
 
+  s.Watch(mock.AsStdFunction());
 
-TEST(BorrowTest, EnableBorrowableFromThisMove) {
-  class Foo : public enable_borrowable_from_this<Foo> {
-   public:
-    Foo(int i)
-      : i(i) {}
+  // Relinquishes the remaining 63 borrows at once.
+  borrows.relinquish();
+
+  EXPECT_EQ(s.borrows(), 1);
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(s.borrows(), 0);
+}
+
+
+TEST(BorrowTest, Lease) {
+  Borrowable<string> s("hello world");
+
+  auto lease = s.Lease(4);
+
+  EXPECT_EQ(4, s.borrows());
+  EXPECT_EQ(4u, lease.credits());
+
+  vector<borrowed_ptr<string>> borrows;
+  for (size_t i = 0; i < 4; i++) {
+    borrows.push_back(lease.take());
+  }
+
+  EXPECT_EQ(4, s.borrows());
+  EXPECT_EQ(0u, lease.credits());
+  EXPECT_EQ("hello world", *borrows.back());
+
+  // Acquires another block.
+  borrows.push_back(lease.take());
+
+  EXPECT_EQ(8, s.borrows());
+  EXPECT_EQ(3u, lease.credits());
+
+  for (auto& borrowed : borrows) {
+    lease.give_back(std::move(borrowed));
+    EXPECT_FALSE(borrowed);
+  }
+
+  EXPECT_EQ(8, s.borrows());
+  EXPECT_EQ(8u, lease.credits());
+
+  // Borrows that don't get given back get relinquished as usual.
+  borrowed_ptr<string> borrowed = lease.take();
+
+  lease.flush();
+
+  EXPECT_EQ(1, s.borrows());
+  EXPECT_EQ(0u, lease.credits());
+
+  borrowed.relinquish();
+
+  EXPECT_EQ(0, s.borrows());
+}
+
+
+TEST(BorrowTest, WatchWaitsForLease) {
+  Borrowable<string> s("hello world");
+
+  auto lease = s.Lease(4);
+
+  borrowed_ptr<string> borrowed = lease.take();
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(0);
+
+  s.Watch(mock.AsStdFunction());
+
+  lease.give_back(std::move(borrowed));
+
+  EXPECT_TRUE(testing::Mock::VerifyAndClearExpectations(&mock));
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  lease.flush();
+}
+
+
+TEST(BorrowTest, Weak) {
+  auto* s = new Borrowable<string>("hello world");
+
+  borrowed_weak<string> weak = s->Weak();
+
+  // Weak references aren't borrows.
+  EXPECT_EQ(s->borrows(), 0);
+  EXPECT_FALSE(weak.expired());
+
+  borrowed_weak<string> copied = weak;
+
+  {
+    borrowed_ptr<string> borrowed = copied.try_borrow();
+
+    ASSERT_TRUE(borrowed);
+    EXPECT_EQ("hello world", *borrowed);
+    EXPECT_EQ(s->borrows(), 1);
+
+    // Can also get a weak reference from a borrow.
+    borrowed_weak<const string> reweak = borrowed.weak();
+
+    EXPECT_EQ("hello world", *reweak.try_borrow());
+  }
+
+  EXPECT_EQ(s->borrows(), 0);
+
+  // Destructing doesn't wait for weak references and the weak
+  // references are still safe to use afterwards.
+  delete s;
+
+  EXPECT_TRUE(weak.expired());
+  EXPECT_FALSE(weak.try_borrow());
+  EXPECT_FALSE(copied.try_borrow());
+
+  weak.reset();
+
+  EXPECT_TRUE(weak.expired());
+  EXPECT_FALSE(weak.try_borrow());
+}
+
+
+TEST(BorrowTest, WeakFailsWhileDraining) {
+  Borrowable<string> s("hello world");
+
+  borrowed_weak<string> weak = s.Weak();
+
+  EXPECT_TRUE(s.Drain([]() {}));
+
+  // Not expired, but not borrowable either.
+  EXPECT_FALSE(weak.expired());
+  EXPECT_FALSE(weak.try_borrow());
+}
+
+
+TEST(BorrowTest, WeakWhileDestructing) {
+  for (size_t i = 0; i < 100; i++) {
+    auto* s = new Borrowable<string, stout::Sharded>("hello world");
+
+    borrowed_weak<string> weak = s->Weak();
+
+    atomic<bool> stop = false;
+
+    // NOTE: just like with any other borrow, borrowing before 'delete'
+    // only keeps the borrowable alive, not 'string', so we don't
+    // dereference what we borrow.
+    thread t([&, weak]() {
+      while (!stop.load()) {
+        if (!weak.try_borrow()) {
+          EXPECT_TRUE(weak.expired());
+        }
+      }
+    });
+
+    std::this_thread::yield();
+
+    delete s;
+
+    EXPECT_TRUE(weak.expired());
+
+    stop.store(true);
+
+    t.join();
+  }
+}
+
+
+TEST(BorrowTest, DeferRelinquish) {
+  Borrowable<string> s("hello world");
+
+  {
+    DeferRelinquish defer;
+
+    for (size_t i = 0; i < 3; i++) {
+      borrowed_ptr<string> borrowed = s.Borrow();
+      EXPECT_EQ("hello world", *borrowed);
+    }
+
+    // Deferred borrows are still outstanding.
+    EXPECT_EQ(s.borrows(), 3);
+
+    {
+      DeferRelinquish nested;
+      borrowed_ref<string> borrowed = s.Borrow();
+    }
+
+    // Only the outermost scope flushes.
+    EXPECT_EQ(s.borrows(), 4);
+
+    DeferRelinquish::Flush();
+
+    EXPECT_EQ(s.borrows(), 0);
+
+    borrowed_ref<string> borrowed = s.Borrow();
+  }
+
+  EXPECT_EQ(s.borrows(), 0);
+}
+
+
+TEST(BorrowTest, DeferRelinquishFull) {
+  vector<unique_ptr<Borrowable<int>>> borrowables;
+
+  for (size_t i = 0; i <= DeferRelinquish::kCapacity; i++) {
+    borrowables.push_back(std::make_unique<Borrowable<int>>(i));
+  }
+
+  {
+    DeferRelinquish defer;
+
+    for (auto& borrowable : borrowables) {
+      borrowed_ref<int> borrowed = borrowable->Borrow();
+    }
+
+    // Once the table is full we relinquish right away.
+    for (size_t i = 0; i < DeferRelinquish::kCapacity; i++) {
+      EXPECT_EQ(borrowables[i]->borrows(), 1);
+    }
+    EXPECT_EQ(borrowables.back()->borrows(), 0);
+  }
+
+  for (auto& borrowable : borrowables) {
+    EXPECT_EQ(borrowable->borrows(), 0);
+  }
+}
+
+
+TEST(BorrowTest, DeferRelinquishOnlyDefersOwnThread) {
+  Borrowable<string> s("hello world");
+
+  atomic<bool> deferring(false);
+  atomic<bool> done(false);
+
+  thread t([&]() {
+    DeferRelinquish defer;
+    deferring.store(true);
+    while (!done.load()) {
+      std::this_thread::yield();
+    }
+  });
+
+  while (!deferring.load()) {
+    std::this_thread::yield();
+  }
+
+  // Another thread deferring doesn't defer our relinquishes.
+  {
+    borrowed_ref<string> borrowed = s.Borrow();
+  }
+
+  EXPECT_EQ(s.borrows(), 0);
+
+  done.store(true);
+
+  t.join();
+}
+
+
+TEST(BorrowTest, WatchFlushesDeferred) {
+  Borrowable<string> s("hello world");
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  DeferRelinquish defer;
+
+  {
+    borrowed_ref<string> borrowed = s.Borrow();
+  }
+
+  EXPECT_EQ(s.borrows(), 1);
+
+  // Our own deferred borrows get flushed first.
+  EXPECT_TRUE(s.Watch(mock.AsStdFunction()));
+
+  EXPECT_EQ(s.borrows(), 0);
+}
+
+
+TEST(BorrowTest, DestructWaitsForDeferred) {
+  atomic<bool> deferred(false);
+  atomic<bool> flushed(false);
+
+  auto* s = new Borrowable<string>("hello world");
+
+  thread t([&]() {
+    DeferRelinquish defer;
+
+    {
+      borrowed_ref<string> borrowed = s->Borrow();
+    }
+
+    deferred.store(true);
+
+    // Take long enough that the destructor will park.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    flushed.store(true);
+  });
+
+  while (!deferred.load()) {
+    std::this_thread::yield();
+  }
+
+  delete s;
+
+  EXPECT_TRUE(flushed.load());
+
+  t.join();
+}
+
+
+TEST(BorrowTest, SharedAndExclusive) {
+  Borrowable<string> s("hello world");
+
+  {
+    borrowed_ref<const string> shared = s.BorrowShared();
+    borrowed_ref<const string> reborrowed = shared.reborrow();
+
+    EXPECT_EQ("hello world", *shared);
+    EXPECT_EQ(s.borrows(), 2);
+
+    // Can't exclusively borrow while there are shared borrows.
+    EXPECT_FALSE(s.TryBorrowExclusive());
+
+    EXPECT_TRUE(s.TryBorrowShared());
+  }
+
+  borrowed_exclusive_ptr<string> exclusive = s.BorrowExclusive();
+
+  ASSERT_TRUE(exclusive);
+
+  *exclusive = "goodbye";
+
+  EXPECT_EQ(s.borrows(), 1);
+
+  // Can't borrow shared (or exclusively) while exclusively borrowed.
+  EXPECT_FALSE(s.TryBorrowShared());
+  EXPECT_FALSE(s.TryBorrowExclusive());
+
+  borrowed_exclusive_ptr<string> moved = std::move(exclusive);
+
+  EXPECT_FALSE(exclusive);
+  EXPECT_EQ(s.borrows(), 1);
+
+  moved.relinquish();
+
+  EXPECT_EQ(s.borrows(), 0);
+
+  EXPECT_EQ("goodbye", *s.TryBorrowShared());
+}
+
+
+TEST(BorrowTest, ExclusiveWaitsForShared) {
+  Borrowable<string> s("hello world");
+
+  atomic<bool> relinquished(false);
+
+  borrowed_ptr<const string> shared = s.BorrowShared();
+
+  thread t([&relinquished, shared = std::move(shared)]() mutable {
+    // Take long enough that we'll park.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    relinquished.store(true);
+    shared.relinquish();
+  });
+
+  borrowed_exclusive_ptr<string> exclusive = s.BorrowExclusive();
+
+  EXPECT_TRUE(relinquished.load());
+
+  t.join();
+}
+
+
+TEST(BorrowTest, SharedWaitsForExclusive) {
+  Borrowable<string> s("hello world");
+
+  borrowed_exclusive_ptr<string> exclusive = s.BorrowExclusive();
+
+  thread t([exclusive = std::move(exclusive)]() mutable {
+    // Take long enough that we'll park.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    *exclusive = "goodbye";
+    exclusive.relinquish();
+  });
+
+  EXPECT_EQ("goodbye", *s.BorrowShared());
+
+  t.join();
+}
+
+
+TEST(BorrowTest, SharedAndExclusiveConcurrently) {
+  Borrowable<vector<int>> v;
+
+  vector<thread> threads;
+
+  for (size_t i = 0; i < 4; i++) {
+    threads.emplace_back([&]() {
+      for (size_t j = 0; j < 1000; j++) {
+        if (j % 4 == 0) {
+          borrowed_exclusive_ptr<vector<int>> exclusive = v.BorrowExclusive();
+          exclusive->push_back(j);
+        } else {
+          borrowed_ref<const vector<int>> shared = v.BorrowShared();
+          for (int k : *shared) {
+            EXPECT_EQ(0, k % 4);
+          }
+        }
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(1000u, v.BorrowShared()->size());
+}
+
+
+TEST(BorrowTest, ExclusiveAndRead) {
+  Borrowable<string> s("hello world");
+
+  { auto read = s.Read(); }
+
+  // Read borrows aren't in the tally so once read borrowed an
+  // exclusive borrow has to wait for a grace period instead.
+  EXPECT_FALSE(s.TryBorrowExclusive());
+
+  {
+    auto exclusive = s.BorrowExclusive();
+    EXPECT_EQ("hello world", *exclusive);
+  }
+
+  EXPECT_EQ(s.borrows(), 0);
+
+  EXPECT_DEATH(
+      {
+        Borrowable<string> s("hello world");
+        auto exclusive = s.BorrowExclusive();
+        auto read = s.Read();
+      },
+      "while exclusively borrowed");
+}
+
+
+TEST(BorrowTest, ExclusiveWaitsForRead) {
+  Borrowable<string> s("hello world");
+
+  atomic<bool> reading(false);
+  atomic<bool> read(false);
+
+  thread t([&]() {
+    auto borrowed = s.Read();
+
+    reading.store(true);
+
+    // Take long enough that the exclusive borrow has to wait.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    read.store(true);
+  });
+
+  while (!reading.load()) {
+    std::this_thread::yield();
+  }
+
+  {
+    auto exclusive = s.BorrowExclusive();
+    EXPECT_TRUE(read.load());
+  }
+
+  t.join();
+}
+
+
+TEST(BorrowTest, BorrowedPtrUpcast) {
+  struct Base {
+    int i = 42;
+  };
+
+  struct Derived : public Base {};
+
+  Borrowable<Derived> derived;
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  borrowed_ptr<Base> base = derived.Borrow();
+
+  base->i++;
+
+  EXPECT_EQ(43, base->i);
+
+  derived.Watch(mock.AsStdFunction());
+}
+
+
+TEST(BorrowTest, BorrowedPtrConstUpcast) {
+  struct Base {
+    int i = 42;
+  };
+
+  struct Derived : public Base {};
+
+  Borrowable<Derived> derived;
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  borrowed_ptr<const Base> base = derived.Borrow();
+
+  EXPECT_EQ(42, base->i);
+
+  derived.Watch(mock.AsStdFunction());
+}
+
+
+TEST(BorrowTest, ConstBorrowedPtrUpcast) {
+  struct Base {
+    int i = 42;
+  };
+
+  struct Derived : public Base {};
+
+  Borrowable<const Derived> derived;
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  borrowed_ptr<const Base> base = derived.Borrow();
+
+  EXPECT_EQ(42, base->i);
+
+  derived.Watch(mock.AsStdFunction());
+}
+
+
+TEST(BorrowTest, BorrowCompact) {
+  Borrowable<string> s("hello world");
+
+  borrowed_compact_ptr<string> borrowed = s.BorrowCompact();
+
+  EXPECT_EQ(1, s.borrows());
+  EXPECT_EQ("hello world", *borrowed);
+  EXPECT_EQ(&*s, borrowed.get());
+
+  borrowed_compact_ptr<string> reborrowed = borrowed.reborrow();
+
+  EXPECT_EQ(2, s.borrows());
+
+  borrowed_ref<string> reference = reborrowed.reference();
+
+  EXPECT_EQ(3, s.borrows());
+  EXPECT_EQ("hello world", *reference);
+
+  // Moving (and converting an rvalue) doesn't reborrow.
+  borrowed_compact_ptr<string> moved = std::move(reborrowed);
+
+  EXPECT_FALSE(reborrowed);
+  EXPECT_EQ(3, s.borrows());
+
+  borrowed_ptr<const string> converted = std::move(moved);
+
+  EXPECT_FALSE(moved);
+  EXPECT_EQ(3, s.borrows());
+  EXPECT_EQ("hello world", *converted);
+
+  vector<borrowed_compact_ptr<string>> borrows;
+  for (size_t i = 0; i < 4; i++) {
+    borrows.push_back(s.BorrowCompact());
+  }
+
+  EXPECT_EQ(7, s.borrows());
+
+  borrows.clear();
+  converted.relinquish();
+  reference = borrowed.reference();
+  borrowed.relinquish();
+
+  EXPECT_EQ(1, s.borrows());
+}
+
+
+TEST(BorrowTest, BorrowCompactUpcast) {
+  struct Base {
+    virtual ~Base() = default;
+    int i = 42;
+  };
+
+  struct Derived : public Base {};
+
+  Borrowable<Derived, stout::Sharded> derived;
+
+  borrowed_compact_ptr<Derived, stout::Sharded> borrowed =
+      derived.BorrowCompact();
+
+  borrowed_ptr<Base> base = borrowed;
+
+  EXPECT_EQ(2, derived.borrows());
+  EXPECT_EQ(42, base->i);
+
+  borrowed.relinquish();
+  base.relinquish();
+
+  EXPECT_EQ(0, derived.borrows());
+}
+
+
+TEST(BorrowTest, Subscript) {
+  Borrowable<vector<int>> v(vector<int>{1, 2, 3});
+
+  borrowed_ref<vector<int>> ref = v.Borrow();
+  borrowed_ptr<vector<int>> ptr = v.Borrow();
+
+  EXPECT_EQ(2, ref[1]);
+
+  ptr[1] = 42;
+
+  EXPECT_EQ(42, ref[1]);
+}
+
+
+TEST(BorrowTest, BorrowSpan) {
+  Borrowable<vector<int>> v(vector<int>{1, 2, 3, 4, 5});
+
+  borrowed_span<int> span = v.BorrowSpan();
+
+  EXPECT_EQ(1, v.borrows());
+  EXPECT_EQ(5u, span.size());
+  EXPECT_EQ(v->data(), span.data());
+
+  int sum = 0;
+  for (int i : span) {
+    sum += i;
+  }
+
+  EXPECT_EQ(15, sum);
+
+  borrowed_span<int> subspan = span.subspan(1, 3);
+
+  EXPECT_EQ(2, v.borrows());
+  EXPECT_EQ(3u, subspan.size());
+  EXPECT_EQ(2, subspan[0]);
+  EXPECT_EQ(4, subspan[2]);
+
+  subspan[0] = 42;
+
+  EXPECT_EQ(42, v->at(1));
+
+  borrowed_span<const int> moved = std::move(subspan);
+
+  EXPECT_FALSE(subspan);
+  EXPECT_EQ(2, v.borrows());
+  EXPECT_EQ(42, moved[0]);
+
+  moved.relinquish();
+  span.relinquish();
+
+  EXPECT_EQ(0, v.borrows());
+
+  Borrowable<int[4]> array;
+
+  EXPECT_EQ(4u, array.BorrowSpan().size());
+}
+
+
+TEST(BorrowTest, SplitBorrowedSpan) {
+  Borrowable<vector<int>> v(vector<int>(10, 1));
+
+  borrowed_span<int> span = v.BorrowSpan();
+
+  vector<borrowed_span<int>> chunks = span.split(4);
+
+  EXPECT_EQ(5, v.borrows());
+
+  ASSERT_EQ(4u, chunks.size());
+  EXPECT_EQ(3u, chunks[0].size());
+  EXPECT_EQ(3u, chunks[1].size());
+  EXPECT_EQ(2u, chunks[2].size());
+  EXPECT_EQ(2u, chunks[3].size());
+  EXPECT_EQ(span.data(), chunks[0].data());
+  EXPECT_EQ(span.data() + 8, chunks[3].data());
+
+  span.relinquish();
+
+  // Each chunk gets processed (and relinquished) on its own thread
+  // while we wait for all of them to be relinquished.
+  vector<thread> threads;
+  for (auto& chunk : chunks) {
+    threads.emplace_back([chunk = std::move(chunk)]() mutable {
+      for (int& i : chunk) {
+        i *= 2;
+      }
+    });
+  }
+
+  v.WaitUntilBorrowsEquals(0);
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(vector<int>(10, 2), *v);
+}
+
+
+TEST(BorrowTest, SplitEmptyBorrowedSpan) {
+  borrowed_span<int> span;
+
+  // Just like 'subspan()' and 'reborrow()' an empty span splits into
+  // empty spans.
+  vector<borrowed_span<int>> chunks = span.split(3);
+
+  ASSERT_EQ(3u, chunks.size());
+
+  for (auto& chunk : chunks) {
+    EXPECT_FALSE(chunk);
+    EXPECT_TRUE(chunk.empty());
+  }
+
+  EXPECT_FALSE(span.subspan(0, 0));
+}
+
+
+TEST(BorrowTest, Alias) {
+  struct Header {
+    int length = 0;
+  };
+
+  struct Packet {
+    Header header;
+    string payload;
+  };
+
+  Borrowable<Packet> packet(Packet{Header{11}, "hello world"});
+
+  borrowed_ref<Packet> borrowed = packet.Borrow();
+
+  borrowed_ref<Header> header = borrowed.alias(&Packet::header);
+
+  EXPECT_EQ(2, packet.borrows());
+  EXPECT_EQ(&packet->header, &*header);
+  EXPECT_EQ(11, header->length);
+
+  // Projections work too.
+  borrowed_ptr<char> first = borrowed_ptr<Packet>(borrowed.reborrow())
+                                 .alias([](Packet& packet) -> char& {
+                                   return packet.payload[0];
+                                 });
+
+  EXPECT_EQ(3, packet.borrows());
+  EXPECT_EQ('h', *first);
+
+  // Aliasing an rvalue doesn't reborrow.
+  borrowed_ptr<const string> payload =
+      borrowed_ptr<const Packet>(std::move(borrowed))
+          .alias(&Packet::payload);
+
+  EXPECT_EQ(3, packet.borrows());
+  EXPECT_EQ("hello world", *payload);
+
+  EXPECT_FALSE(borrowed_ptr<Packet>().alias(&Packet::header));
+
+  header = std::move(header).alias(&Header::length).alias(
+      [&](int&) -> Header& { return packet->header; });
+
+  EXPECT_EQ(3, packet.borrows());
+
+  payload.relinquish();
+  first.relinquish();
+
+  EXPECT_EQ(1, packet.borrows());
+}
+
+
+TEST(BorrowTest, MoveBorrowable) {
+  Borrowable<string> s("hello world");
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  atomic<bool> moving(false);
+
+  auto t = thread([&]() {
+    moving.store(true);
+    Borrowable<string> moved = std::move(s);
+    moving.store(false);
+  });
+
+  while (!moving.load()) {}
+
+  EXPECT_EQ("hello world", *s);
+
+  borrowed_ptr<string> reborrowed = borrowed.reborrow();
+
+  borrowed.relinquish();
+
+  EXPECT_TRUE(moving.load());
+
+  reborrowed.relinquish();
+
+  t.join();
+
+  EXPECT_FALSE(moving.load());
+
+  EXPECT_EQ("", *s);
+}
+
+
+TEST(BorrowTest, DestructWithSlowBorrower) {
+  atomic<bool> relinquished(false);
+
+  thread t;
+
+  {
+    Borrowable<string> s("hello world");
+
+    borrowed_ptr<string> borrowed = s.Borrow();
+
+    t = thread([&relinquished, borrowed = std::move(borrowed)]() mutable {
+      // Take long enough that the destructor will park, see
+      // 'BorrowableStatsTest.DestructWithSlowBorrower' which checks
+      // that it actually does.
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      relinquished.store(true);
+      borrowed.relinquish();
+    });
+  }
+
+  EXPECT_TRUE(relinquished.load());
+
+  t.join();
+}
+
+
+TEST(BorrowTest, Read) {
+  Borrowable<string> s("hello world");
+
+  {
+    auto read = s.Read();
+
+    EXPECT_EQ("hello world", *read);
+
+    // Reads are not counted as borrows.
+    EXPECT_EQ(s.borrows(), 0);
+
+    // Reads can be nested.
+    auto nested = s.Read();
+
+    EXPECT_EQ(11, nested->size());
+  }
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  s.Watch(mock.AsStdFunction());
+}
+
+
+TEST(BorrowTest, WatchWaitsForReads) {
+  Borrowable<string> s("hello world");
+
+  atomic<bool> reading(false);
+  atomic<bool> wait(true);
+
+  thread t([&]() {
+    auto read = s.Read();
+    reading.store(true);
+    while (wait.load()) {}
+    EXPECT_EQ("hello world", *read);
+  });
+
+  while (!reading.load()) {}
+
+  atomic<bool> watched(false);
+
+  thread watcher([&]() {
+    s.Watch([&]() {
+      watched.store(true);
+    });
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  EXPECT_FALSE(watched.load());
+
+  wait.store(false);
+
+  watcher.join();
+
+  EXPECT_TRUE(watched.load());
+
+  t.join();
+}
+
+
+TEST(BorrowTest, DestructWaitsForReads) {
+  atomic<bool> reading(false);
+  atomic<bool> read(false);
+
+  thread t;
+
+  {
+    Borrowable<string> s("hello world");
+
+    t = thread([&]() {
+      auto borrowed = s.Read();
+      reading.store(true);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      EXPECT_EQ("hello world", *borrowed);
+      read.store(true);
+    });
+
+    while (!reading.load()) {}
+  }
+
+  EXPECT_TRUE(read.load());
+
+  t.join();
+}
+
+
+TEST(BorrowTest, CallableMove) {
+  Borrowable<std::string> s("hello world");
+
+  auto callable = s.Borrow([&]() {
+    EXPECT_EQ(s.borrows(), 1);
+  });
+
+  EXPECT_EQ(s.borrows(), 1);
+
+  {
+    auto moved = std::move(callable);
+
+    EXPECT_EQ(s.borrows(), 1);
+
+    moved();
+  }
+
+  EXPECT_EQ(s.borrows(), 0);
+}
+
+
+TEST(BorrowTest, CallableCopy) {
+  Borrowable<std::string> s("hello world");
+
+  auto callable = s.Borrow([&]() {
+    EXPECT_EQ(s.borrows(), 2);
+  });
+
+  EXPECT_EQ(s.borrows(), 1);
+
+  {
+    auto copy = callable;
+
+    EXPECT_EQ(s.borrows(), 2);
+
+    copy();
+  }
+
+  EXPECT_EQ(s.borrows(), 1);
+}
+
+
+TEST(BorrowTest, EnableBorrowableFromThis) {
+  class Foo : public enable_borrowable_from_this<Foo> {
+   public:
+    Foo(int i)
+      : i(i) {}
+    int i = 0;
+  };
+
+  Foo foo(42);
+
+  EXPECT_EQ(foo.borrows(), 0);
+
+  borrowed_ptr<Foo> borrowed = foo.Borrow();
+
+  EXPECT_EQ(foo.borrows(), 1);
+
+  EXPECT_EQ(borrowed->i, 42);
+}
+
+
+TEST(BorrowTest, EnableBorrowableFromThisMove) {
+  class Foo : public enable_borrowable_from_this<Foo> {
+   public:
+    Foo(int i)
+      : i(i) {}
+    int i = 0;
+  };
+
+  Foo foo(42);
+
+  Foo moved = std::move(foo);
+
+  EXPECT_EQ(moved.borrows(), 0);
+
+  borrowed_ptr<Foo> borrowed = moved.Borrow();
+
+  EXPECT_EQ(moved.borrows(), 1);
+
+  EXPECT_EQ(borrowed->i, 42);
+}
+
+
+TEST(BorrowTest, EnableBorrowableFromThisCopy) {
+  class Foo : public enable_borrowable_from_this<Foo> {
+   public:
+    Foo(int i)
+      : i(i) {}
     int i = 0;
   };
 
-  Foo foo(42);
+  Foo foo(42);
+
+  Foo copy = foo;
+
+  EXPECT_EQ(copy.borrows(), 0);
+
+  borrowed_ptr<Foo> borrowed = copy.Borrow();
+
+  EXPECT_EQ(copy.borrows(), 1);
+
+  EXPECT_EQ(borrowed->i, 42);
+}
+
+
+TEST(BorrowTest, ShardedBorrowPtr) {
+  Borrowable<string, stout::Sharded> s("hello world");
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  EXPECT_EQ(s.borrows(), 1);
+
+  borrowed_ptr<string> reborrow = borrowed.reborrow();
+
+  EXPECT_EQ(s.borrows(), 2);
+
+  EXPECT_EQ("hello world", *reborrow);
+
+  s.Watch(mock.AsStdFunction());
+
+  borrowed.relinquish();
+  reborrow.relinquish();
+
+  EXPECT_EQ(s.borrows(), 0);
+
+  // Shards should be used again after the watch callback was invoked.
+  borrowed = s.Borrow();
+
+  EXPECT_EQ(s.borrows(), 1);
+}
+
+
+TEST(BorrowTest, ShardedMultipleBorrows) {
+  Borrowable<string, stout::Sharded> s("hello world");
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(0);
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  vector<thread> threads;
+
+  atomic<bool> wait(true);
+
+  for (size_t i = 0; i < 8; i++) {
+    // Borrow on one thread and relinquish on another so that the
+    // shards end up with different (and negative) counts.
+    threads.push_back(thread([&wait, borrowed = borrowed.reborrow()]() {
+      while (wait.load()) {}
+      // ... destructor will invoke borrowed.relinquish().
+    }));
+  }
+
+  borrowed.relinquish();
+
+  s.Watch(mock.AsStdFunction());
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
 
-  Foo moved = std::move(foo);
+  wait.store(false);
 
-  EXPECT_EQ(moved.borrows(), 0);
+  for (auto&& thread : threads) {
+    thread.join();
+  }
 
-  borrowed_ptr<Foo> borrowed = moved.Borrow();
+  EXPECT_EQ(s.borrows(), 0);
+}
 
-  EXPECT_EQ(moved.borrows(), 1);
 
-  EXPECT_EQ(borrowed->i, 42);
+TEST(BorrowTest, ShardedMoveBorrowable) {
+  Borrowable<string, stout::Sharded> s("hello world");
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  atomic<bool> moving(false);
+
+  auto t = thread([&]() {
+    moving.store(true);
+    Borrowable<string, stout::Sharded> moved = std::move(s);
+    moving.store(false);
+  });
+
+  while (!moving.load()) {}
+
+  thread([borrowed = std::move(borrowed)]() {}).join();
+
+  t.join();
+
+  EXPECT_FALSE(moving.load());
+
+  EXPECT_EQ("", *s);
+
+  EXPECT_EQ(s.borrows(), 0);
 }
 
 
-TEST(BorrowTest, EnableBorrowableFromThisCopy) {
-  class Foo : public enable_borrowable_from_this<Foo> {
+TEST(BorrowTest, ShardedWatchWhileBorrowing) {
+  for (size_t i = 0; i < 100; i++) {
+    Borrowable<string, stout::Sharded> s("hello world");
+
+    atomic<bool> drained(false);
+    atomic<int> outstanding(0);
+
+    // Borrows that succeed while watching (or once draining) must
+    // never be missed, i.e., end up on a shard rather than in the
+    // tally, and no borrows can succeed once drained.
+    vector<thread> threads;
+
+    for (size_t j = 0; j < 4; j++) {
+      threads.emplace_back([&]() {
+        while (!drained.load()) {
+          borrowed_ptr<string> borrowed = s.TryBorrow();
+          if (borrowed) {
+            EXPECT_FALSE(drained.load());
+            outstanding++;
+            std::this_thread::yield();
+            outstanding--;
+          }
+        }
+      });
+    }
+
+    // Watching folds (and the watch callback unfolds) while the
+    // threads keep borrowing.
+    for (size_t j = 0; j < 10; j++) {
+      atomic<bool> watched(false);
+
+      s.Watch([&]() {
+        watched.store(true);
+      });
+
+      while (!watched.load()) {
+        std::this_thread::yield();
+      }
+    }
+
+    s.Drain([&]() {
+      EXPECT_EQ(0, outstanding.load());
+      drained.store(true);
+    });
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    EXPECT_EQ(s.borrows(), 0);
+  }
+}
+
+
+TEST(BorrowTest, ShardedWaitUntilBorrowsEquals) {
+  Borrowable<string, stout::Sharded> s("hello world");
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  thread t([borrowed = std::move(borrowed)]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  });
+
+  s.WaitUntilBorrowsEquals(0);
+
+  t.join();
+
+  // The shards get used again after waiting so borrowing on one
+  // thread and relinquishing on another must still be counted
+  // correctly.
+  vector<thread> threads;
+
+  for (size_t i = 0; i < 8; i++) {
+    threads.push_back(thread([borrowed = s.Borrow()]() {}));
+  }
+
+  for (auto&& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(s.borrows(), 0);
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  s.Watch(mock.AsStdFunction());
+}
+
+
+TEST(BorrowTest, CacheAligned) {
+  // The tally must not share a cache line with 'T'.
+  auto separated = [](const void* borrowable, const void* t) {
+    auto offset = reinterpret_cast<uintptr_t>(t)
+        - reinterpret_cast<uintptr_t>(borrowable);
+    return reinterpret_cast<uintptr_t>(t) % 64 == 0 && offset >= 64;
+  };
+
+  Borrowable<int, stout::CacheAligned<>> i(42);
+
+  EXPECT_TRUE(separated(&i, &*i));
+
+  borrowed_ptr<int> borrowed = i.Borrow();
+
+  EXPECT_EQ(1, i.borrows());
+  EXPECT_EQ(42, *borrowed);
+
+  borrowed.relinquish();
+
+  // Works with any policy.
+  Borrowable<int, stout::CacheAligned<stout::Sharded>> sharded(42);
+
+  EXPECT_TRUE(separated(&sharded, &*sharded));
+
+  borrowed = sharded.Borrow();
+
+  EXPECT_EQ(1, sharded.borrows());
+
+  borrowed.relinquish();
+
+  Borrowable<int, stout::CacheAligned<stout::Sharded>> moved =
+      std::move(sharded);
+
+  EXPECT_EQ(42, *moved.Borrow());
+
+  class Foo
+    : public enable_borrowable_from_this<Foo, stout::CacheAligned<>> {
    public:
-    Foo(int i)
-      : i(i) {}
-    int i = 0;
+    int i = 42;
   };
 
-  Foo foo(42);
+  Foo foo;
 
-  Foo copy = foo;
+  EXPECT_TRUE(separated(&foo, &foo.i));
+  EXPECT_EQ(42, foo.Borrow()->i);
+}
 
-  EXPECT_EQ(copy.borrows(), 0);
 
-  borrowed_ptr<Foo> borrowed = copy.Borrow();
+TEST(BorrowTest, TryBorrow) {
+  Borrowable<string> s("hello world");
 
-  EXPECT_EQ(copy.borrows(), 1);
+  // Unlimited by default.
+  borrowed_ptr<string> borrowed = s.TryBorrow();
 
-  EXPECT_EQ(borrowed->i, 42);
+  EXPECT_TRUE(borrowed);
+
+  borrowed.relinquish();
+
+  s.LimitBorrows(2);
+
+  borrowed_ptr<string> first = s.TryBorrow();
+  borrowed_ptr<string> second = s.TryBorrow();
+  borrowed_ptr<string> third = s.TryBorrow();
+
+  EXPECT_TRUE(first);
+  EXPECT_TRUE(second);
+  EXPECT_FALSE(third);
+
+  // Reborrowing is never limited.
+  borrowed_ptr<string> reborrowed = first.reborrow();
+
+  EXPECT_TRUE(reborrowed);
+  EXPECT_EQ(s.borrows(), 3);
+
+  first.relinquish();
+  reborrowed.relinquish();
+
+  third = s.TryBorrow();
+
+  EXPECT_TRUE(third);
+
+  // Changing the limit applies to subsequent borrows.
+  s.LimitBorrows(3);
+
+  borrowed = s.TryBorrow();
+
+  EXPECT_TRUE(borrowed);
+  EXPECT_FALSE(s.TryBorrow());
+}
+
+
+TEST(BorrowTest, WatchBorrowsBelow) {
+  Borrowable<string, stout::Sharded> s("hello world");
+
+  s.LimitBorrows(4);
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  // Invoked immediately since there are no borrows.
+  EXPECT_TRUE(s.WatchBorrowsBelow(1, mock.AsStdFunction()));
+
+  vector<borrowed_ptr<string>> borrows;
+  for (size_t i = 0; i < 4; i++) {
+    borrows.push_back(s.TryBorrow());
+    EXPECT_TRUE(borrows.back());
+  }
+
+  EXPECT_FALSE(s.TryBorrow());
+
+  MockFunction<void()> below;
+
+  EXPECT_CALL(below, Call())
+      .Times(0);
+
+  EXPECT_TRUE(s.WatchBorrowsBelow(3, below.AsStdFunction()));
+
+  // Only one can be armed at a time.
+  EXPECT_FALSE(s.WatchBorrowsBelow(3, []() {}));
+
+  // Doesn't count the borrow held while armed.
+  EXPECT_EQ(s.borrows(), 4);
+
+  EXPECT_FALSE(s.TryBorrow());
+
+  borrows.back().relinquish();
+  borrows.pop_back();
+
+  EXPECT_CALL(below, Call())
+      .WillOnce([&]() {
+        // Invoked before the borrow that drops below the threshold
+        // gets relinquished.
+        EXPECT_EQ(s.borrows(), 3);
+      });
+
+  borrows.back().relinquish();
+  borrows.pop_back();
+
+  EXPECT_EQ(s.borrows(), 2);
+
+  borrows.push_back(s.TryBorrow());
+  borrows.push_back(s.TryBorrow());
+
+  EXPECT_TRUE(borrows.back());
+  EXPECT_FALSE(s.TryBorrow());
+}
+
+
+TEST(BorrowTest, MoveWhileWatchingBorrowsBelow) {
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(0);
+
+  Borrowable<string> s("hello world");
+
+  s.LimitBorrows(1);
+
+  borrowed_ptr<string> borrowed = s.TryBorrow();
+
+  EXPECT_TRUE(s.WatchBorrowsBelow(1, mock.AsStdFunction()));
+
+  auto t = thread([borrowed = std::move(borrowed)]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  });
+
+  {
+    // Moving disarms (without invoking the callback) and waits for
+    // the outstanding borrow.
+    Borrowable<string> moved = std::move(s);
+  }
+
+  t.join();
+}
+
+
+TEST(BorrowTest, TryBorrowConcurrently) {
+  Borrowable<int> i(0);
+
+  constexpr size_t kLimit = 4;
+
+  i.LimitBorrows(kLimit);
+
+  atomic<size_t> borrowing(0);
+  atomic<size_t> admitted(0);
+  atomic<size_t> notified(0);
+
+  vector<thread> threads;
+
+  for (size_t t = 0; t < 8; t++) {
+    threads.push_back(thread([&]() {
+      for (size_t n = 0; n < 10000; n++) {
+        borrowed_ptr<int> borrowed = i.TryBorrow();
+        if (borrowed) {
+          EXPECT_LE(borrowing.fetch_add(1) + 1, kLimit);
+          admitted++;
+          borrowing--;
+        } else {
+          i.WatchBorrowsBelow(kLimit, [&]() { notified++; });
+        }
+      }
+    }));
+  }
+
+  for (auto&& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_GT(admitted.load(), 0u);
+  EXPECT_EQ(i.borrows(), 0);
+}
+
+
+TEST(BorrowTest, Drain) {
+  Borrowable<string> s("hello world");
+
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(0);
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  EXPECT_TRUE(s.Drain(mock.AsStdFunction()));
+
+  EXPECT_FALSE(s.Drain([]() {}));
+
+  // New borrows are rejected without being fatal.
+  EXPECT_FALSE(s.TryBorrow());
+
+  // But outstanding borrows can still be reborrowed.
+  borrowed_ptr<string> reborrowed = borrowed.reborrow();
+
+  EXPECT_EQ(s.borrows(), 2);
+
+  borrowed.relinquish();
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  reborrowed.relinquish();
+
+  EXPECT_EQ(s.borrows(), 0);
+
+  // Stays drained.
+  EXPECT_FALSE(s.TryBorrow());
+  EXPECT_FALSE(s.Drain([]() {}));
+}
+
+
+TEST(BorrowTest, DrainWhileWatching) {
+  Borrowable<string> s("hello world");
+
+  MockFunction<void()> watch;
+  MockFunction<void()> drain;
+
+  EXPECT_CALL(watch, Call())
+      .Times(0);
+
+  EXPECT_CALL(drain, Call())
+      .Times(0);
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  EXPECT_TRUE(s.Watch(watch.AsStdFunction()));
+
+  // Draining takes over the watch.
+  EXPECT_TRUE(s.Drain(drain.AsStdFunction()));
+
+  EXPECT_FALSE(s.TryBorrow());
+
+  testing::Mock::VerifyAndClearExpectations(&watch);
+  testing::Mock::VerifyAndClearExpectations(&drain);
+
+  testing::InSequence sequence;
+
+  EXPECT_CALL(watch, Call())
+      .Times(1);
+
+  EXPECT_CALL(drain, Call())
+      .Times(1);
+
+  borrowed.relinquish();
+
+  EXPECT_FALSE(s.TryBorrow());
+}
+
+
+TEST(BorrowTest, WatchWhileDraining) {
+  Borrowable<string> s("hello world");
+
+  MockFunction<void()> drain;
+
+  EXPECT_CALL(drain, Call())
+      .Times(0);
+
+  borrowed_ptr<string> borrowed = s.Borrow();
+
+  EXPECT_TRUE(s.Drain(drain.AsStdFunction()));
+
+  // Can't watch while draining since we'll never go back to
+  // 'Borrowing', nor once drained.
+  EXPECT_FALSE(s.Watch([]() { ADD_FAILURE(); }));
+
+  EXPECT_CALL(drain, Call())
+      .Times(1);
+
+  borrowed.relinquish();
+
+  EXPECT_FALSE(s.Watch([]() { ADD_FAILURE(); }));
+}
+
+
+TEST(BorrowTest, DestructWhileDraining) {
+  MockFunction<void()> mock;
+
+  EXPECT_CALL(mock, Call())
+      .Times(1);
+
+  thread t;
+
+  {
+    Borrowable<string, stout::Sharded> s("hello world");
+
+    borrowed_ptr<string> borrowed = s.Borrow();
+
+    EXPECT_TRUE(s.Drain(mock.AsStdFunction()));
+
+    t = thread([borrowed = std::move(borrowed)]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    });
+
+    // Destructing waits for draining to finish.
+  }
+
+  t.join();
 }
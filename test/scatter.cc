@@ -0,0 +1,127 @@
+#include "stout/scatter.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "stout/thread_pool.h"
+
+using std::atomic;
+using std::string;
+using std::vector;
+
+using stout::Borrowable;
+using stout::borrowed_ptr;
+using stout::Scatter;
+using stout::ThreadPool;
+
+
+TEST(ScatterTest, Scatter) {
+  ThreadPool pool(4);
+
+  constexpr size_t kTasks = 100;
+
+  Borrowable<vector<int>> v(vector<int>(kTasks, 0));
+
+  atomic<bool> done(false);
+
+  Scatter(
+      v,
+      kTasks,
+      [](size_t i, borrowed_ptr<vector<int>> v) {
+        (*v)[i] += static_cast<int>(i);
+      },
+      pool,
+      [&]() {
+        done.store(true);
+      });
+
+  while (!done.load()) {}
+
+  EXPECT_EQ(0, v.borrows());
+
+  for (size_t i = 0; i < kTasks; i++) {
+    EXPECT_EQ(static_cast<int>(i), (*v)[i]);
+  }
+}
+
+
+TEST(ScatterTest, ScatterNothing) {
+  ThreadPool pool(1);
+
+  Borrowable<string> s("hello world");
+
+  bool done = false;
+
+  Scatter(
+      s,
+      0,
+      [](size_t, borrowed_ptr<string>) {
+        FAIL();
+      },
+      pool,
+      [&]() {
+        done = true;
+      });
+
+  EXPECT_TRUE(done);
+}
+
+
+TEST(ScatterTest, DoneWaitsForBorrows) {
+  ThreadPool pool(2);
+
+  Borrowable<string> s("hello world");
+
+  atomic<size_t> finished(0);
+  atomic<bool> done(false);
+
+  vector<borrowed_ptr<string>> kept(4);
+
+  // Tasks can keep their borrows past returning.
+  Scatter(
+      s,
+      kept.size(),
+      [&](size_t i, borrowed_ptr<string> s) {
+        kept[i] = std::move(s);
+        finished++;
+      },
+      pool,
+      [&]() {
+        done.store(true);
+      });
+
+  while (finished.load() != kept.size()) {}
+
+  EXPECT_FALSE(done.load());
+
+  kept.clear();
+
+  EXPECT_TRUE(done.load());
+}
+
+
+TEST(ThreadPoolTest, SubmitFromTasks) {
+  atomic<size_t> count(0);
+
+  {
+    ThreadPool pool(4);
+
+    for (size_t i = 0; i < 10; i++) {
+      pool.Submit([&]() {
+        for (size_t j = 0; j < 10; j++) {
+          pool.Submit([&]() {
+            count++;
+          });
+        }
+        count++;
+      });
+    }
+
+    // Destructing waits for every task, including those submitted
+    // from other tasks.
+  }
+
+  EXPECT_EQ(110u, count.load());
+}